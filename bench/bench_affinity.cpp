@@ -0,0 +1,87 @@
+// Memory bandwidth of CPU-heavy children under each manager placement
+// policy. Every child runs a STREAM-style triad (a = b + s * c) over its own
+// arrays and reports the bandwidth it saw; the manager runs as many at once
+// as there are hardware threads.
+//
+// usage: bench_affinity [tasks] [mb] [passes]
+//   defaults: 2 x hardware threads, 256 MB per child, 20 passes
+// (bench_affinity --child mb passes is the child itself)
+#include <subprocess_manager.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+using namespace subprocess_manager;
+
+static int run_child(size_t mb, int passes){
+    size_t count = (mb << 20) / (3 * sizeof(double));
+    std::unique_ptr<double[]> a(new double[count]);
+    std::unique_ptr<double[]> b(new double[count]);
+    std::unique_ptr<double[]> c(new double[count]);
+    // first touch places the pages on the node the child runs on
+    for(size_t i = 0; i < count; i++){
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    for(int pass = 0; pass < passes; pass++){
+        double scale = 1.0 + pass;
+        for(size_t i = 0; i < count; i++){
+            a[i] = b[i] + scale * c[i];
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    // keep the loop from being optimised away
+    double check = a[count / 2];
+    printf("%.3f %g\n", 3.0 * sizeof(double) * count * passes / seconds / 1e9, check);
+    return 0;
+}
+
+int main(int argc, char** argv){
+    if(argc == 4 && strcmp(argv[1], "--child") == 0){
+        return run_child(atoi(argv[2]), atoi(argv[3]));
+    }
+    unsigned threads = std::thread::hardware_concurrency();
+    int tasks = argc > 1 ? atoi(argv[1]) : 2 * (int)threads;
+    int mb = argc > 2 ? atoi(argv[2]) : 256;
+    int passes = argc > 3 ? atoi(argv[3]) : 20;
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(length <= 0){
+        perror("readlink");
+        return 1;
+    }
+    self[length] = '\0';
+    std::string command = std::string(self) + " --child " + std::to_string(mb) + " " + std::to_string(passes);
+
+    printf("%u hardware threads, %d children x %d MB x %d passes\n", threads, tasks, mb, passes);
+    printf("%-10s %12s %14s %14s\n", "placement", "makespan_s", "child_GB/s", "slowest_GB/s");
+    struct Policy {
+        const char* name;
+        Placement_ placement;
+    } policies[] = {{"none", Placement_None}, {"cores", Placement_Cores}, {"nodes", Placement_Nodes}};
+    for(const Policy& policy : policies){
+        SubprocessManager manager;
+        manager.m_placement = policy.placement;
+        for(int i = 0; i < tasks; i++){
+            manager.add("child" + std::to_string(i), command);
+        }
+        manager.start();
+        double total = 0.0;
+        double slowest = 0.0;
+        for(Subprocess* process : manager.m_processes){
+            double bandwidth = atof(process->m_output.str().c_str());
+            total += bandwidth;
+            if(slowest == 0.0 || bandwidth < slowest){
+                slowest = bandwidth;
+            }
+        }
+        printf("%-10s %12.2f %14.2f %14.2f\n", policy.name, manager.m_makespan, total / tasks, slowest);
+    }
+    return 0;
+}
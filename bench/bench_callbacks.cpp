@@ -0,0 +1,92 @@
+// Latency from a child's write() to the m_on_line callback. Every child
+// writes lines holding the steady clock time (CLOCK_MONOTONIC, shared by
+// all processes on Linux) at which it wrote them; the callback, run on the
+// reactor thread, subtracts that from its own clock. Nothing is retained
+// (Capture_None), as for a consumer that only forwards the output.
+//
+// usage: bench_callbacks [lines] [interval_us] [children...]
+//   defaults: 1000 lines 1000 us apart, 1 16 64 children
+// (bench_callbacks --child lines interval_us is the child itself)
+#include <subprocess_manager.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace subprocess_manager;
+
+static long long now_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int run_child(int lines, int interval_us){
+    for(int i = 0; i < lines; i++){
+        // one write() per line, so each is its own pipe event
+        char line[32];
+        int length = snprintf(line, sizeof(line), "%lld\n", now_ns());
+        if(write(STDOUT_FILENO, line, length) != length){
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv){
+    if(argc == 4 && strcmp(argv[1], "--child") == 0){
+        return run_child(atoi(argv[2]), atoi(argv[3]));
+    }
+    int lines = argc > 1 ? atoi(argv[1]) : 1000;
+    int interval_us = argc > 2 ? atoi(argv[2]) : 1000;
+    std::vector<int> counts;
+    for(int i = 3; i < argc; i++){
+        counts.push_back(atoi(argv[i]));
+    }
+    if(counts.empty()){
+        counts = {1, 16, 64};
+    }
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(length <= 0){
+        perror("readlink");
+        return 1;
+    }
+    self[length] = '\0';
+    std::string command = std::string(self) + " --child " + std::to_string(lines) + " " + std::to_string(interval_us);
+
+    printf("%d lines per child, %d us apart\n", lines, interval_us);
+    printf("%8s %10s %10s %10s %10s %10s\n", "children", "lines", "p50_us", "p99_us", "p999_us", "max_us");
+    for(int count : counts){
+        // every callback runs on the one reactor thread: no locking needed
+        std::vector<long long> latencies;
+        latencies.reserve((size_t)count * lines);
+        SubprocessManager manager;
+        manager.m_max_running = 0;
+        for(int i = 0; i < count; i++){
+            std::string name = "child" + std::to_string(i);
+            manager.add(name, command);
+            Subprocess* process = manager[name];
+            process->m_output.set_capture(Capture_None);
+            process->m_on_line = [&latencies](Stream_, std::string_view line){
+                long long written = strtoll(std::string(line).c_str(), nullptr, 10);
+                latencies.push_back(now_ns() - written);
+            };
+        }
+        manager.start();
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p){
+            if(latencies.empty()){
+                return 0.0;
+            }
+            size_t index = std::min(latencies.size() - 1, (size_t)(p * latencies.size()));
+            return latencies[index] / 1000.0;
+        };
+        printf("%8d %10zu %10.1f %10.1f %10.1f %10.1f\n", count, latencies.size(),
+               percentile(0.5), percentile(0.99), percentile(0.999), latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+// Thousands of processes in flight: one blocked thread per process against
+// start_future() and co_await run(), which leave the waiting to the reactor.
+// Each process is `sleep`; the thread count is sampled once all of them
+// have been started.
+//
+// usage: bench_coroutines [seconds] [count...]
+//   defaults: sleep 0.2 s, 1000 2000 processes
+#include <subprocess_manager.h>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+using namespace subprocess_manager;
+
+// Fire-and-forget coroutine: runs until its first co_await, then resumes
+// wherever that awaitable resumes it
+struct Detached {
+    struct promise_type {
+        Detached get_return_object(){ return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ std::terminate(); }
+    };
+};
+
+static Detached run_one(Subprocess* process, std::atomic<int>* failed, std::atomic<int>* done){
+    RunResult result = co_await process->run();
+    if(result.return_code != 0){
+        (*failed)++;
+    }
+    (*done)++;
+    done->notify_all();
+}
+
+static int threads_now(){
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)){
+        if(line.rfind("Threads:", 0) == 0){
+            return atoi(line.c_str() + 8);
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char** argv){
+    std::string seconds = argc > 1 ? argv[1] : "0.2";
+    std::vector<int> counts;
+    for(int i = 2; i < argc; i++){
+        counts.push_back(atoi(argv[i]));
+    }
+    if(counts.empty()){
+        counts = {1000, 2000};
+    }
+    // pipes and a pidfd per child
+    struct rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    std::string command = "sleep " + seconds;
+
+    printf("%-12s %10s %10s %10s %8s\n", "waiting", "processes", "wall_ms", "threads", "failed");
+    for(int count : counts){
+        for(int mode = 0; mode < 3; mode++){
+            std::vector<std::unique_ptr<Subprocess>> processes;
+            for(int i = 0; i < count; i++){
+                processes.emplace_back(new Subprocess("sleep" + std::to_string(i), command));
+            }
+            std::atomic<int> failed(0);
+            int threads = 0;
+            auto begin = std::chrono::steady_clock::now();
+            if(mode == 0){
+                std::vector<std::thread> waiters;
+                for(auto& process : processes){
+                    Subprocess* p = process.get();
+                    waiters.emplace_back([p, &failed](){
+                        if(p->start()->m_return_code != 0){
+                            failed++;
+                        }
+                    });
+                }
+                threads = threads_now();
+                for(std::thread& waiter : waiters){
+                    waiter.join();
+                }
+            }else if(mode == 1){
+                std::vector<std::future<RunResult>> futures;
+                for(auto& process : processes){
+                    futures.push_back(process->start_future());
+                }
+                threads = threads_now();
+                for(auto& future : futures){
+                    if(future.get().return_code != 0){
+                        failed++;
+                    }
+                }
+            }else{
+                std::atomic<int> done(0);
+                for(auto& process : processes){
+                    run_one(process.get(), &failed, &done);
+                }
+                threads = threads_now();
+                for(int seen = done.load(); seen < count; seen = done.load()){
+                    done.wait(seen);
+                }
+            }
+            double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            const char* names[] = {"thread each", "futures", "coroutines"};
+            printf("%-12s %10d %10.1f %10d %8d\n", names[mode], count, wall, threads, failed.load());
+        }
+    }
+    return 0;
+}
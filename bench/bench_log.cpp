@@ -0,0 +1,46 @@
+// Throughput of the log path for a child that writes a lot of output:
+// copying through the LogWriter thread against splice()/tee() on Linux.
+//
+// usage: bench_log [megabytes] [log_dir]
+//   defaults: 1024 /tmp
+// The child is `yes <line> | head -c <megabytes>`, one 64 byte line per row.
+#include <subprocess_manager.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+using namespace subprocess_manager;
+
+struct Mode {
+    const char*         name;
+    bool                splice;
+    Capture_            capture;
+};
+
+int main(int argc, char** argv){
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 1024;
+    std::string log_dir = argc > 2 ? argv[2] : "/tmp";
+    std::string line(63, 'x');
+    std::string command = "sh -c \"yes " + line + " | head -c " + std::to_string(megabytes << 20) + "\"";
+    std::string log_path = log_dir + "/bench_log.txt";
+    Mode modes[] = {
+        {"writer", false, Capture_None},
+        {"splice", true, Capture_None},
+        {"writer+tail", false, Capture_TailBytes},
+        {"tee+tail", true, Capture_TailBytes},
+    };
+    printf("child output %zu MiB, log %s\n", megabytes, log_path.c_str());
+    printf("%-14s %10s %10s\n", "path", "seconds", "GB/s");
+    for(Mode& mode : modes){
+        Subprocess process("bench", command, "", log_path);
+        process.m_log_policy.splice = mode.splice;
+        process.m_output.set_capture(mode.capture, 1024 * 1024);
+        auto begin = std::chrono::steady_clock::now();
+        process.start();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printf("%-14s %10.2f %10.2f\n", mode.name, seconds, (megabytes << 20) / seconds / 1e9);
+        unlink(log_path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Compares the shared reactor against the previous design (one monitor
+// thread per child plus a manager thread polling every 100 ms).
+//
+// usage: bench_reactor [task_path] [sleep_ms] [count...]
+//   defaults: ./task 200 10 1000 10000
+// Each child is `task 1 <sleep_ms> 0`: it prints one line and sleeps, so all
+// children of a run are alive at the same time.
+#include <subprocess_manager.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+using namespace subprocess_manager;
+extern char **environ;
+
+struct Result {
+    double spawn_ms;        // time to start every child
+    double wall_ms;         // time until the manager reports completion
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Previous design: blocking read + waitpid on a dedicated thread per child,
+// completion detected by a manager loop sleeping 100 ms between scans.
+static Result run_thread_per_child(const std::string& task, int sleep_ms, int count){
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> monitors;
+    std::vector<std::atomic<bool>> done(count);
+    std::string sleep_arg = std::to_string(sleep_ms);
+    for(int i = 0; i < count; i++){
+        int fds[2];
+        if(pipe(fds) != 0){
+            perror("pipe");
+            exit(1);
+        }
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+        char* argv[] = {(char*)task.c_str(), (char*)"1", (char*)sleep_arg.c_str(), (char*)"0", nullptr};
+        pid_t pid;
+        if(posix_spawn(&pid, task.c_str(), &actions, nullptr, argv, environ) != 0){
+            perror("posix_spawn");
+            exit(1);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        int read_fd = fds[0];
+        monitors.emplace_back([read_fd, pid, &done, i](){
+            char buffer[4096];
+            while(read(read_fd, buffer, sizeof(buffer)) > 0);
+            close(read_fd);
+            waitpid(pid, nullptr, 0);
+            done[i] = true;
+        });
+    }
+    Result result;
+    result.spawn_ms = elapsed_ms(begin);
+    while(true){
+        bool all_done = true;
+        for(int i = 0; i < count; i++){
+            if(!done[i]){
+                all_done = false;
+            }
+        }
+        if(all_done){
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    result.wall_ms = elapsed_ms(begin);
+    for(std::thread& monitor : monitors){
+        monitor.join();
+    }
+    return result;
+}
+
+static Result run_reactor(const std::string& task, int sleep_ms, int count){
+    SubprocessManager manager;
+    // every child at once, like the thread-per-child design
+    manager.m_max_running = 0;
+    std::string command = task + " 1 " + std::to_string(sleep_ms) + " 0";
+    for(int i = 0; i < count; i++){
+        manager.add("task" + std::to_string(i), command);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    manager.start_async();
+    Result result;
+    result.spawn_ms = elapsed_ms(begin);
+    manager.join();
+    result.wall_ms = elapsed_ms(begin);
+    return result;
+}
+
+int main(int argc, char** argv){
+    std::string task = argc > 1 ? argv[1] : "./task";
+    int sleep_ms = argc > 2 ? atoi(argv[2]) : 200;
+    std::vector<int> counts;
+    for(int i = 3; i < argc; i++){
+        counts.push_back(atoi(argv[i]));
+    }
+    if(counts.empty()){
+        counts = {10, 1000, 10000};
+    }
+    // every child costs the parent a pipe and a pidfd
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    printf("%-18s %8s %12s %12s %14s %8s\n", "design", "children", "spawn_ms", "wall_ms", "completion_lag", "threads");
+    for(int count : counts){
+        // completion lag: time between the children finishing their sleep and
+        // the manager reporting the batch as done
+        Result threads = run_thread_per_child(task, sleep_ms, count);
+        printf("%-18s %8d %12.1f %12.1f %14.1f %8d\n", "thread-per-child", count,
+               threads.spawn_ms, threads.wall_ms, threads.wall_ms - threads.spawn_ms - sleep_ms, count + 1);
+        Result reactor = run_reactor(task, sleep_ms, count);
+        printf("%-18s %8d %12.1f %12.1f %14.1f %8d\n", "reactor", count,
+               reactor.spawn_ms, reactor.wall_ms, reactor.wall_ms - reactor.spawn_ms - sleep_ms, 1);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Throughput of the output scanner (line splitting, CRLF normalisation,
+// ANSI stripping) for each implementation on a synthetic coloured log.
+//
+// usage: bench_scanner [megabytes] [repeat]
+//   defaults: 256 5
+#include "line_scanner.h"
+#include <output_buffer.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+using namespace subprocess_manager;
+
+// Compiler/test-runner style output: CRLF line endings, a colour escape on
+// roughly a third of the lines.
+static std::string make_log(size_t size){
+    static const char* words[] = {"compiling", "src/module.cpp", "warning:", "[ RUN      ]", "test_case_",
+                                  "ok", "0.123s", "linking", "target", "-O2", "note:", "passed"};
+    std::mt19937 random(7);
+    std::string log;
+    log.reserve(size + 256);
+    while(log.size() < size){
+        if(random() % 3 == 0){
+            log += "\x1b[1;32m";
+        }
+        int words_in_line = 4 + random() % 10;
+        for(int i = 0; i < words_in_line; i++){
+            log += words[random() % 12];
+            log += ' ';
+        }
+        if(random() % 3 == 0){
+            log += "\x1b[0m";
+        }
+        log += "\r\n";
+    }
+    log.resize(size);
+    return log;
+}
+
+int main(int argc, char** argv){
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 256;
+    int repeat = argc > 2 ? atoi(argv[2]) : 5;
+    std::string log = make_log(megabytes << 20);
+    std::vector<char> work(log.size());
+    std::vector<uint32_t> line_ends;
+    line_ends.reserve(log.size() / 16);
+
+    struct { const char* name; unsigned filter; } filters[] = {
+        {"lines", Filter_None},
+        {"lines+crlf", Filter_CRLF},
+        {"lines+ansi", Filter_ANSI},
+        {"lines+crlf+ansi", Filter_CRLF | Filter_ANSI},
+    };
+    struct { const char* name; ScanImpl_ impl; } impls[] = {
+        {"scalar", ScanImpl_Scalar},
+        {"sse2", ScanImpl_SSE2},
+        {"avx2", ScanImpl_AVX2},
+    };
+    printf("input %zu MiB, best implementation on this CPU: %s\n", megabytes,
+           impls[scan_best_impl() - ScanImpl_Scalar].name);
+    printf("%-18s %-8s %10s %10s\n", "mode", "impl", "GB/s", "lines");
+    for(auto& filter : filters){
+        for(auto& impl : impls){
+            double best = 0;
+            size_t lines = 0;
+            for(int i = 0; i < repeat; i++){
+                std::memcpy(work.data(), log.data(), log.size());
+                line_ends.clear();
+                ScanState state = {};
+                // same 64 KiB granularity as the output arena
+                auto begin = std::chrono::steady_clock::now();
+                for(size_t pos = 0; pos < work.size(); pos += OutputBuffer::CHUNK_SIZE){
+                    size_t size = std::min(OutputBuffer::CHUNK_SIZE, work.size() - pos);
+                    state.pending_cr = false;
+                    scan_lines(work.data() + pos, size, filter.filter, state, line_ends, 0, impl.impl);
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                double rate = log.size() / seconds / 1e9;
+                if(rate > best){
+                    best = rate;
+                }
+                lines = line_ends.size();
+            }
+            printf("%-18s %-8s %10.2f %10zu\n", filter.name, impl.name, best, lines);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Spawn rate and latency as the parent's resident memory grows: the
+// previous fork()+exec path against Subprocess (clone with CLONE_VM |
+// CLONE_VFORK on Linux).
+//
+// usage: bench_spawn [--server] [count] [rss_mb...]
+//   defaults: 1000 0 256 1024 2048
+//   --server starts the spawn server before the parent grows
+// Latency is the time until the child has exec()ed (start_async() returns).
+#include <subprocess_manager.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace subprocess_manager;
+extern char **environ;
+
+struct Result {
+    double per_second;      // spawns per second over the whole run
+    double p50_us;          // median spawn latency
+    double p99_us;          // 99th percentile spawn latency
+};
+
+static Result summarize(std::vector<double>& latencies, double seconds){
+    std::sort(latencies.begin(), latencies.end());
+    Result result;
+    result.per_second = latencies.size() / seconds;
+    result.p50_us = latencies[latencies.size() / 2];
+    result.p99_us = latencies[latencies.size() * 99 / 100];
+    return result;
+}
+
+// Previous design: fork(), exec in the child, parent waits on a close-on-exec
+// pipe until the exec happened.
+static Result run_fork(const char* path, int count){
+    std::vector<double> latencies;
+    std::vector<pid_t> children;
+    char* argv[] = {(char*)path, nullptr};
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++){
+        auto spawn_begin = std::chrono::steady_clock::now();
+        int err_pipe[2];
+        if(pipe2(err_pipe, O_CLOEXEC) != 0){
+            perror("pipe2");
+            exit(1);
+        }
+        pid_t pid = fork();
+        if(pid == 0){
+            execve(path, argv, environ);
+            _exit(127);
+        }
+        close(err_pipe[1]);
+        char byte;
+        while(read(err_pipe[0], &byte, 1) > 0);
+        close(err_pipe[0]);
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - spawn_begin).count());
+        children.push_back(pid);
+    }
+    for(pid_t pid : children){
+        waitpid(pid, nullptr, 0);
+    }
+    return summarize(latencies, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+}
+
+static Result run_subprocess(const char* path, int count){
+    std::vector<double> latencies;
+    std::vector<std::unique_ptr<Subprocess>> children;
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++){
+        children.emplace_back(new Subprocess("child", path, "", "", {{}}, Redirect_Null, Redirect_Null));
+        auto spawn_begin = std::chrono::steady_clock::now();
+        children.back()->start_async();
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - spawn_begin).count());
+    }
+    for(auto& child : children){
+        child->join();
+    }
+    return summarize(latencies, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+}
+
+int main(int argc, char** argv){
+    int first = 1;
+    const char* design = "subprocess";
+    if(argc > 1 && strcmp(argv[1], "--server") == 0){
+        SubprocessManager::start_spawn_server();
+        design = "server";
+        first++;
+    }
+    int count = argc > first ? atoi(argv[first]) : 1000;
+    std::vector<size_t> sizes;
+    for(int i = first + 1; i < argc; i++){
+        sizes.push_back(atoi(argv[i]));
+    }
+    if(sizes.empty()){
+        sizes = {0, 256, 1024, 2048};
+    }
+    const char* path = "/bin/true";
+    printf("%-12s %8s %12s %10s %10s\n", "design", "rss_mb", "spawns/s", "p50_us", "p99_us");
+    std::vector<std::unique_ptr<char[]>> ballast;
+    size_t resident = 0;
+    for(size_t size : sizes){
+        // grow the parent's resident set; every page is touched
+        if(size > resident){
+            size_t bytes = (size - resident) << 20;
+            ballast.emplace_back(new char[bytes]);
+            memset(ballast.back().get(), 1, bytes);
+            resident = size;
+        }
+        Result fork_result = run_fork(path, count);
+        printf("%-12s %8zu %12.0f %10.1f %10.1f\n", "fork", size, fork_result.per_second, fork_result.p50_us, fork_result.p99_us);
+        Result spawn_result = run_subprocess(path, count);
+        printf("%-12s %8zu %12.0f %10.1f %10.1f\n", design, size, spawn_result.per_second, spawn_result.p50_us, spawn_result.p99_us);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Scanning the state of a large manager: a pass over every Subprocess
+// object (m_state and m_return_code, one pointer and a few cache lines per
+// task) against the manager's task table (count() and failed(), contiguous
+// arrays). The run behind it spawns a few real children; one of them fails
+// and every other task depends on it, so the rest are skipped.
+//
+// usage: bench_tasks [tasks] [passes]
+//   defaults: 100000 tasks, 50 passes
+#include <subprocess_manager.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace subprocess_manager;
+
+int main(int argc, char** argv){
+    int tasks = argc > 1 ? atoi(argv[1]) : 100000;
+    int passes = argc > 2 ? atoi(argv[2]) : 50;
+    const int children = 16;
+    if(tasks <= children){
+        fprintf(stderr, "need more than %d tasks\n", children);
+        return 1;
+    }
+    SubprocessManager manager;
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < tasks; i++){
+        std::string name = "task" + std::to_string(i);
+        manager.add(name, i < children - 1 ? "true" : "false", "", "", {{}}, Redirect_Null, Redirect_Null);
+        if(i >= children){
+            manager.depends_on(name, {"task" + std::to_string(children - 1)});
+        }
+    }
+    auto added = std::chrono::steady_clock::now();
+    manager.start();
+    auto ran = std::chrono::steady_clock::now();
+    printf("%d tasks: add %.1f ms, start %.1f ms\n", tasks,
+           std::chrono::duration<double, std::milli>(added - begin).count(),
+           std::chrono::duration<double, std::milli>(ran - added).count());
+
+    // the same two questions asked both ways; the sums keep the passes from
+    // being optimised away
+    auto time_passes = [&](auto&& pass){
+        size_t sum = 0;
+        auto scan_begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < passes; i++){
+            sum += pass();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - scan_begin).count();
+        return std::make_pair(ns / ((double)passes * tasks), sum / passes);
+    };
+    auto objects_count = time_passes([&](){
+        size_t found = 0;
+        for(Subprocess* process : manager.m_processes){
+            found += process->m_state.load(std::memory_order_relaxed) == Subprocess_Completed;
+        }
+        return found;
+    });
+    auto table_count = time_passes([&](){ return manager.count(Subprocess_Completed); });
+    auto objects_failed = time_passes([&](){
+        std::vector<size_t> found;
+        for(size_t i = 0; i < manager.m_processes.size(); i++){
+            if(manager.m_processes[i]->m_return_code != 0){
+                found.push_back(i);
+            }
+        }
+        return found.size();
+    });
+    auto table_failed = time_passes([&](){ return manager.failed().size(); });
+    printf("%-10s %22s %22s\n", "", "count(Completed)", "failed()");
+    printf("%-10s %12s %9s %12s %9s\n", "scan", "ns_per_task", "result", "ns_per_task", "result");
+    printf("%-10s %12.2f %9zu %12.2f %9zu\n", "objects", objects_count.first, objects_count.second, objects_failed.first, objects_failed.second);
+    printf("%-10s %12.2f %9zu %12.2f %9zu\n", "table", table_count.first, table_count.second, table_failed.first, table_failed.second);
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Teardown time of a manager full of running children: terminate() drops
+// the queue, SIGKILLs every child's process group from the reactor thread
+// and returns once all of them are reaped.
+//
+// usage: bench_terminate [count...]
+//   defaults: 1000 5000
+#include <subprocess_manager.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/resource.h>
+using namespace subprocess_manager;
+
+int main(int argc, char** argv){
+    std::vector<int> counts;
+    for(int i = 1; i < argc; i++){
+        counts.push_back(atoi(argv[i]));
+    }
+    if(counts.empty()){
+        counts = {1000, 5000};
+    }
+    // one pidfd per child
+    struct rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    printf("%8s %12s %14s %10s\n", "children", "start_ms", "terminate_ms", "survivors");
+    for(int count : counts){
+        SubprocessManager manager;
+        manager.m_max_running = 0;
+        for(int i = 0; i < count; i++){
+            manager.add("sleep" + std::to_string(i), "sleep 600", "", "", {{}}, Redirect_Null, Redirect_Null);
+        }
+        auto begin = std::chrono::steady_clock::now();
+        manager.start_async();
+        auto started = std::chrono::steady_clock::now();
+        manager.terminate();
+        auto ended = std::chrono::steady_clock::now();
+        // every child was reaped, so none of their pids may answer
+        int survivors = 0;
+        for(Subprocess* process : manager.m_processes){
+            if(process->m_process_id > 0 && (kill(process->m_process_id, 0) == 0 || errno != ESRCH)){
+                survivors++;
+            }
+        }
+        printf("%8d %12.1f %14.1f %10d\n", count,
+               std::chrono::duration<double, std::milli>(started - begin).count(),
+               std::chrono::duration<double, std::milli>(ended - started).count(),
+               survivors);
+    }
+    return 0;
+}
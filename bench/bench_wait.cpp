@@ -0,0 +1,88 @@
+// Wake-up latency of a thread blocked on a child's completion, measured
+// from m_end_time (when the reactor saw the exit) and from the child's last
+// write (steady clock time printed by the child, CLOCK_MONOTONIC is shared
+// by all processes on Linux), which adds the child's own exit. The waiter's
+// CPU time shows that it sleeps instead of polling m_state.
+//
+// usage: bench_wait [runs]
+//   defaults: 500 runs per way of waiting
+// (bench_wait --child is the child itself)
+#include <subprocess_manager.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+using namespace subprocess_manager;
+
+static long long now_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long long thread_cpu_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int main(int argc, char** argv){
+    if(argc == 2 && strcmp(argv[1], "--child") == 0){
+        printf("%lld\n", now_ns());
+        return 0;
+    }
+    int runs = argc > 1 ? atoi(argv[1]) : 500;
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(length <= 0){
+        perror("readlink");
+        return 1;
+    }
+    self[length] = '\0';
+    std::string command = std::string(self) + " --child";
+
+    struct Way {
+        const char* name;
+        void (*wait)(Subprocess&);
+    } ways[] = {
+        {"wait_for_state", [](Subprocess& process){ process.wait_for_state(Subprocess_Completed); }},
+        {"wait_until", [](Subprocess& process){ process.wait_until(Subprocess_Completed, std::chrono::steady_clock::now() + std::chrono::seconds(10)); }},
+        {"join", [](Subprocess& process){ process.join(); }},
+    };
+    printf("%d runs\n", runs);
+    printf("%-16s %12s %12s %12s %12s %14s\n", "waiter", "exit_p50_us", "exit_p99_us", "write_p50_us", "write_p99_us", "cpu_us_per_run");
+    for(const Way& way : ways){
+        std::vector<long long> from_exit;
+        std::vector<long long> from_write;
+        long long cpu = 0;
+        for(int i = 0; i < runs; i++){
+            Subprocess process("child", command);
+            process.start_async();
+            long long cpu_begin = thread_cpu_ns();
+            way.wait(process);
+            long long woken = now_ns();
+            cpu += thread_cpu_ns() - cpu_begin;
+            from_exit.push_back(woken - std::chrono::duration_cast<std::chrono::nanoseconds>(process.m_end_time.time_since_epoch()).count());
+            long long written = strtoll(process.m_output.str().c_str(), nullptr, 10);
+            if(written > 0){
+                from_write.push_back(woken - written);
+            }
+        }
+        auto percentile = [](std::vector<long long>& latencies, double p){
+            if(latencies.empty()){
+                return 0.0;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            size_t index = std::min(latencies.size() - 1, (size_t)(p * latencies.size()));
+            return latencies[index] / 1000.0;
+        };
+        printf("%-16s %12.1f %12.1f %12.1f %12.1f %14.1f\n", way.name,
+               percentile(from_exit, 0.5), percentile(from_exit, 0.99),
+               percentile(from_write, 0.5), percentile(from_write, 0.99),
+               runs > 0 ? cpu / 1000.0 / runs : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#ifndef OUTPUT_BUFFER_H          // Include guard to prevent multiple definitions
+#define OUTPUT_BUFFER_H
+#include <atomic>               // For the published snapshot state
+#include <cstddef>              // For size_t
+#include <cstdint>              // For fixed width integers
+#include <map>                  // For lines joined by a snapshot
+#include <string>               // For materialising the captured text
+#include <string_view>          // For zero-copy views into the arena
+#include <vector>               // For the chunk and line tables
+namespace subprocess_manager {
+    enum Filter_ {
+        Filter_None = 0,        // Store output byte for byte
+        Filter_CRLF = 1,        // Rewrite "\r\n" as "\n"
+        Filter_ANSI = 2         // Drop ANSI/VT100 escape sequences (colours, cursor movement)
+    };
+    enum Capture_ {
+        Capture_Full,           // Keep everything
+        Capture_TailBytes,      // Keep the last N bytes
+        Capture_TailLines,      // Keep the last N lines (bounded by a byte budget)
+        Capture_None            // Keep nothing, only count bytes and lines
+    };
+    // Consistent view of an OutputBuffer taken while it is being written.
+    // Holds views into the buffer's chunks, which stay valid until the
+    // buffer is cleared (the process is started again) or destroyed. A long
+    // line that spans chunks is copied together by lines() or partial() into
+    // storage of the snapshot, so a snapshot is for one thread at a time.
+    class OutputSnapshot {
+        public:
+            size_t                                      size() const;       // Bytes of text
+            const std::vector<std::string_view>&        chunks() const;     // Text as ordered contiguous pieces
+            std::vector<std::string_view>               lines() const;      // Complete lines (the last one too once the stream ended)
+            std::string_view                            partial() const;    // Unterminated text after the last complete line
+            bool                                        finished() const;   // The stream had ended
+            std::string                                 str() const;        // Copy of the text
+            OutputSnapshot();                                               // Constructor (empty)
+        private:
+            friend class OutputBuffer;
+            std::vector<std::string_view>               m_chunks;           // Text of each chunk
+            std::vector<size_t>                         m_prefixes;         // Bytes in front of each chunk's text (line carried from the chunk before)
+            std::vector<size_t>                         m_offsets;          // Offset of each chunk's text in the captured text
+            mutable std::map<size_t, std::string>       m_joined;           // Lines spanning chunks by start offset, joined on first use
+            size_t                                      m_size;             // Bytes of text
+            bool                                        m_finished;         // finish() was published
+            std::string_view                            join(size_t begin, size_t end) const; // Text [begin, end) as one view
+    };
+    // Append-only store for a child's captured output.
+    //
+    // Bytes are read straight into large chunks that never move once written,
+    // so lines and the full text are handed out as std::string_view without
+    // copying. A line that does not fit in the rest of a chunk is continued in
+    // the next one together with a copy of its beginning (the chunk "prefix")
+    // when that is at most a quarter of a chunk. A longer line is continued in
+    // place instead and, with Capture_Full, copied together once when it ends,
+    // so the text is held about once and never more than twice. Chunks never
+    // grow past CHUNK_SIZE, so lines are indexed by a 4 byte end offset inside
+    // their chunk; every committed read is run through a vectorised scanner
+    // (line_scanner.h) that finds the line ends across read boundaries and
+    // applies the Filter_ rewrites in place.
+    //
+    // In the Capture_Tail* modes the chunks form a ring of fixed size segments:
+    // once the newer segments hold enough to satisfy the limit the oldest one
+    // is recycled for new output, so memory stays constant however long the
+    // child runs. Lines longer than a quarter of a segment lose their head.
+    // Capture_None reuses a single chunk for every read, keeping only the
+    // unterminated line in front of it.
+    //
+    // With Capture_Full, snapshot() may be called from any thread while the
+    // owner writes. Chunks never move in that mode, so the writer only
+    // publishes each new chunk in an append-only directory and, on every
+    // commit, the text length with one release store; readers never block
+    // it. Everything else is for the owner, or for after the process ended.
+    class OutputBuffer {
+        public:
+            static constexpr size_t                     CHUNK_SIZE = 64 * 1024; // Default chunk capacity
+            static constexpr size_t                     TAIL_MAX_BYTES = 1024 * 1024; // Default byte budget of Capture_TailLines
+            char*                                       prepare(size_t& size); // Writable space for the next read, size receives its length
+            void                                        commit(size_t size);   // Publish size bytes written into prepare()
+            void                                        append(const char* data, size_t size); // prepare + copy + commit
+            void                                        finish();           // Treat a trailing unterminated line as complete
+            void                                        clear();            // Release every chunk (the filter is kept)
+            void                                        set_filter(unsigned filter); // Filter_ bits applied to data committed from now on
+            unsigned                                    filter() const;     // Current Filter_ bits
+            void                                        set_capture(Capture_ capture, size_t limit = 0, size_t max_bytes = TAIL_MAX_BYTES); // Retention policy, set before capturing
+            Capture_                                    capture() const;    // Current retention policy
+            size_t                                      size() const;       // Bytes of retained text
+            size_t                                      line_count() const; // Number of retained complete lines
+            size_t                                      bytes_seen() const; // Bytes captured since clear()
+            size_t                                      lines_seen() const; // Complete lines captured since clear()
+            size_t                                      bytes_dropped() const; // Bytes no longer retained
+            size_t                                      lines_dropped() const; // Lines no longer retained
+            std::string_view                            line(size_t index) const; // Retained line without its newline
+            std::vector<std::string_view>               lines() const;      // Every complete line (a trailing '\r' is not part of the line)
+            std::vector<std::string_view>               chunks() const;     // Retained text as ordered contiguous pieces
+            std::string                                 str() const;        // Copy of the retained text
+            OutputSnapshot                              snapshot() const;   // Consistent view, safe from any thread while writing (Capture_Full only)
+            std::string_view                            recent() const;     // Text stored by the last commit() or finish(), valid until the next prepare()
+            void                                        recent_lines(std::vector<std::string_view>& lines) const; // Append the lines completed by the last commit() or finish()
+            OutputBuffer();                                                 // Constructor
+            ~OutputBuffer();                                                // Destructor
+            OutputBuffer(const OutputBuffer&) = delete;
+            OutputBuffer& operator=(const OutputBuffer&) = delete;
+        private:
+            struct Chunk {
+                char*                                   data;               // Chunk storage
+                size_t                                  capacity;           // Allocated bytes
+                size_t                                  prefix;             // Copy of a line continued from the previous chunk
+                size_t                                  size;               // Bytes used (prefix included)
+                size_t                                  first_line;         // Index of the first line ending in this chunk
+                size_t                                  text_begin;         // Offset of data[prefix] in the captured text
+                char*                                   joined;             // Capture_Full: copy of the first line ending here when it began in an earlier chunk
+                size_t                                  joined_size;        // Its bytes
+            };
+            struct Window {
+                size_t                                  line;               // First retained line
+                size_t                                  chunk;              // Chunk where the retained text starts
+                size_t                                  position;           // Position of that start inside the chunk
+                size_t                                  offset;             // Offset of that start in the captured text
+            };
+            std::vector<Chunk>                          m_chunks;           // Arena chunks in output order
+            std::vector<uint32_t>                       m_line_ends;        // Per line: offset of its end inside its chunk
+            size_t                                      m_line_base;        // Line index of m_line_ends[0]
+            size_t                                      m_line_start;       // Start of the unterminated line in the last chunk (0 if it began in an earlier one)
+            size_t                                      m_line_offset;      // Start of the unterminated line in the captured text
+            size_t                                      m_size;             // Bytes captured since clear()
+            bool                                        m_finished;         // finish() closed the trailing line
+            Capture_                                    m_capture;          // Retention policy
+            size_t                                      m_limit;            // Bytes or lines kept by the tail modes
+            size_t                                      m_max_bytes;        // Byte budget of Capture_TailLines
+            size_t                                      m_segment;          // Chunk capacity in the tail modes
+            unsigned                                    m_filter;           // Filter_ bits
+            uint8_t                                     m_scan_ansi;        // Scanner escape sequence state between reads
+            bool                                        m_pending_cr;       // Scanner held back a '\r' at the end of the last chunk
+            size_t                                      m_recent_begin;     // Start of the last commit() in the last chunk
+            size_t                                      m_recent_size;      // Bytes it stored
+            size_t                                      m_recent_line;      // m_line_ends index of the first line it completed
+            size_t                                      m_recent_line_start; // Where that line starts in the last chunk
+            // Published chunk, immutable once the directory count covers it
+            struct Published {
+                const char*                             data;               // Chunk storage
+                size_t                                  prefix;             // Carried line in front of the text
+                size_t                                  text_begin;         // Offset of data[prefix] in the text
+            };
+            std::atomic<Published*>                     m_directory;        // Published chunks (replaced when it grows)
+            std::atomic<size_t>                         m_directory_count;  // Entries readers may use
+            size_t                                      m_directory_capacity; // Entries m_directory has room for
+            std::vector<Published*>                     m_retired;          // Outgrown directories, freed by clear() as readers may still hold them
+            std::atomic<size_t>                         m_published_size;   // Text readers may see
+            std::atomic<bool>                           m_published_finished; // finish() done
+            void                                        publish_chunk(const Chunk& chunk); // Append to the directory (Capture_Full)
+            size_t                                      chunk_of(size_t line) const; // Chunk holding a line
+            size_t                                      line_begin(size_t line, size_t chunk) const; // Start of a line inside its chunk
+            std::string_view                            line_text(size_t line, size_t chunk) const; // Bytes of a line, from its joined copy if it has one
+            void                                        join_line(size_t end); // Capture_Full: copy together the line ending at end in the last chunk
+            size_t                                      line_offset(size_t line) const; // Start of a line in the captured text
+            bool                                        recycle_oldest() const; // Tail modes: can the oldest chunk go
+            Window                                      window() const;     // Start of the retained output
+    };
+}
+#endif // OUTPUT_BUFFER_H
@@ -1,13 +1,33 @@
 #ifndef SUBPROCESS_MANAGER_H    // Include guard to prevent multiple definitions
 #define SUBPROCESS_MANAGER_H
+#ifdef _WIN32
 #include <windows.h>            // For Windows API functions (process management)
+#else
+#include <sys/types.h>          // For pid_t (POSIX process management)
+#include <sys/resource.h>       // For struct rusage
+#endif
 #include <string>               // For string manipulation
 #include <vector>               // For dynamic arrays
 #include <thread>               // For multithreading
 #include <unordered_map>        // For efficient key-value storage
 #include <ctime>                // For time-related operations
 #include <map>
+#include <atomic>               // For the process state
+#include <cstdint>              // For fixed width integers
+#include <mutex>                // For guarding completion state
+#include <condition_variable>   // For waiting on completion
+#include <functional>           // For completion hooks
+#include <memory>               // For the shared environment snapshot
+#include <chrono>               // For queue and run time measurement
+#include <queue>                // For the ready queue
+#include <deque>                // For queued stdin writes
+#include <future>               // For start_future()
+#include <coroutine>            // For co_await run()
+#include "output_buffer.h"      // For the captured output arena
 namespace subprocess_manager {  // Namespace to encapsulate subprocess management functionality
+    class Environment;
+    class SpawnServer;
+    class Subprocess;
     enum Subprocess_{
         Subprocess_NotStarted,
         Subprocess_Started,
@@ -15,64 +35,353 @@ namespace subprocess_manager {  // Namespace to encapsulate subprocess managemen
         Subprocess_Completed,
         Subprocess_Terminated
     };
+    enum Redirect_ {
+        Redirect_Pipe,          // Pipe to the parent (stdout: captured in m_output, stderr: in m_error_output, stdin: fed by write_stdin())
+        Redirect_Inherit,       // Share the parent's stream
+        Redirect_Null,          // /dev/null (NUL on Windows)
+        Redirect_File,          // File at path, truncated
+        Redirect_Append,        // File at path, appended to
+        Redirect_Fd,            // Existing descriptor (stays open in the parent)
+        Redirect_Stdout         // stderr only: wherever stdout goes, sharing its pipe (2>&1)
+    };
+    // Where one of the child's standard streams goes. Only Redirect_Pipe makes
+    // the parent read (or write) the stream; with every other kind the child
+    // uses the target directly and no reader is started.
+    struct Redirect {
+        Redirect_                                       kind;               // Target kind
+        std::string                                     path;               // File for Redirect_File / Redirect_Append
+        int                                             fd;                 // Descriptor for Redirect_Fd
+        Redirect(Redirect_ kind = Redirect_Pipe);                           // Pipe, Inherit or Null
+        Redirect(std::string path, bool append = false);                    // File
+        Redirect(const char* path, bool append = false);                    // File
+        Redirect(int fd);                                                   // Existing descriptor
+    };
+    enum LogFlush_ {
+        LogFlush_Interval,      // Write pending log output once it is interval_ms old
+        LogFlush_Size,          // Write pending log output once bytes have accumulated
+        LogFlush_Exit           // Write the log when the process completes
+    };
+    // When captured output is committed to m_log_path. Whatever the policy,
+    // the log is complete once the process is, and a backlog of a few MiB is
+    // written out regardless so memory stays bounded.
+    struct LogPolicy {
+        LogFlush_                                       flush = LogFlush_Interval; // Flush trigger
+        size_t                                          bytes = 64 * 1024;  // Threshold of LogFlush_Size
+        unsigned                                        interval_ms = 100;  // Delay of LogFlush_Interval
+        bool                                            splice = false;     // Linux: move output from the pipe to the file in the kernel (the flush policy does not apply; tee()d when it is also captured or m_on_chunk/m_on_line is set)
+    };
+    enum Schedule_ {
+        Schedule_FIFO,          // Start queued tasks in the order they were added
+        Schedule_Priority,      // Start the queued task with the highest m_priority first (FIFO among equals)
+        Schedule_CriticalPath   // Start the queued task with the longest path of m_estimate through its dependents first
+    };
+    enum Placement_ {
+        Placement_None,         // Processes run wherever the OS schedules them
+        Placement_Cores,        // Pin each process to one CPU, spreading them round-robin over the least loaded
+        Placement_Nodes         // Pin each process to the CPUs of one NUMA node, spreading them the same way (Linux)
+    };
+    // Resources used by a child, from wait4() (GetProcessTimes() and
+    // GetProcessMemoryInfo() on Windows, which lack the switch and block
+    // counters). High cpu time against m_duration marks a CPU-bound task;
+    // voluntary switches and block I/O with little cpu time an I/O-bound one.
+    struct ResourceUsage {
+        double                                          user_time = 0.0;    // Seconds of user CPU
+        double                                          system_time = 0.0;  // Seconds of kernel CPU
+        long                                            max_rss_kb = 0;     // Peak resident set size
+        long                                            minor_faults = 0;   // Page faults served without I/O
+        long                                            major_faults = 0;   // Page faults that needed I/O
+        long                                            voluntary_switches = 0; // Context switches while waiting (I/O, locks, sleep)
+        long                                            involuntary_switches = 0; // Preemptions (time slice used up)
+        long                                            input_blocks = 0;   // Block reads from the file system
+        long                                            output_blocks = 0;  // Block writes to the file system
+        void                                            add(const ResourceUsage& other); // Sum the counters, keep the larger max_rss_kb
+    };
+    // Limits set with setrlimit() in the child before exec, -1 keeps the one
+    // inherited from the parent. Values above the inherited hard limit are
+    // lowered to it.
+    struct ResourceLimits {
+        long long                                       address_space = -1; // RLIMIT_AS: bytes of virtual memory
+        long long                                       cpu_time = -1;      // RLIMIT_CPU: seconds of CPU (SIGXCPU, SIGKILL a second later)
+        long long                                       open_files = -1;    // RLIMIT_NOFILE: highest descriptor number + 1
+        long long                                       core_size = -1;     // RLIMIT_CORE: bytes of core dump, 0 disables them
+    };
+    enum Exit_ {
+        Exit_None,              // Not exited (yet)
+        Exit_Normal,            // Exited by itself, m_return_code is its exit status
+        Exit_Signal,            // Killed by a signal, m_return_code is 128 + signal
+        Exit_CpuLimit,          // Killed for using up m_limits.cpu_time
+        Exit_MemoryLimit,       // Crashed or aborted under m_limits.address_space: most likely out of memory
+        Exit_Timeout,           // Stopped after running for m_timeout seconds
+        Exit_IdleTimeout,       // Stopped after m_idle_timeout seconds without output
+        Exit_Terminated,        // Killed by terminate()
+        Exit_Lost               // Exit status unknown, m_return_code is -2
+    };
+    enum Stream_ {
+        Stream_Stdout,          // m_output
+        Stream_Stderr           // m_error_output
+    };
+    // Bytes [begin, end) of one stream's captured text (OutputBuffer::bytes_seen()
+    // offsets), read between the records before and after it
+    struct OutputRecord {
+        Stream_                                         stream;             // Which buffer
+        size_t                                          begin;              // Offset of the first byte
+        size_t                                          end;                // Offset past the last byte
+    };
+    // Outcome of one run, delivered by start_future() and co_await run()
+    struct RunResult {
+        Subprocess*                                     process = nullptr;  // The completed process (output, timing, usage)
+        int                                             return_code = -1;   // m_return_code
+        Exit_                                           exit_reason = Exit_None; // m_exit_reason
+        double                                          duration = 0.0;     // m_duration
+    };
+    // Awaitable returned by Subprocess::run(). co_await starts the process and
+    // suspends the coroutine without blocking a thread; it is resumed from the
+    // reactor thread (POSIX) once the process has completed.
+    class RunAwaitable {
+        public:
+            bool                                        await_ready() const noexcept; // Always suspends: the process is started in await_suspend()
+            void                                        await_suspend(std::coroutine_handle<> handle); // Start the process, resume handle on completion (throws like start_async())
+            RunResult                                   await_resume();     // The process' result
+            explicit RunAwaitable(Subprocess* process);                     // Constructor
+        private:
+            Subprocess*                                 p_process;          // Process to run
+    };
     class Subprocess {
         private:
             // parameters
+#ifdef _WIN32
             STARTUPINFO                                 m_si;               // Startup information for the process
             PROCESS_INFORMATION                         m_pi;               // Process information (ID, handles)
             HANDLE                                      m_hRead;            // Read handle for the process's output
             HANDLE                                      m_hWrite;           // Write handle for the process's input
             std::thread*                                p_monitor_thread;   // Pointer to the monitoring thread
-            clock_t                                     m_start_time;       // Start time of the process
-            std::map<std::string,std::string>           m_env_var;          // Environment variables for the process
+            HANDLE                                      m_timer;            // Timer queue timer checking the timeouts (NULL if none)
+            HANDLE                                      m_hStdin;           // Write end of the child's stdin pipe (NULL if none)
+            HANDLE                                      m_hErrorRead;       // Read end of the child's stderr pipe (NULL if none)
+            std::thread*                                p_error_thread;     // Reads the stderr pipe while monitor() reads stdout
+            std::mutex                                  m_stdin_mutex;      // Serialises writes to m_hStdin
+#else
+            pid_t                                       m_pid;              // Process id of the forked child
+            int                                         m_read_fd;          // Read end of the child's stdout pipe
+            int                                         m_write_fd;         // Write end of the child's stdout pipe
+            int                                         m_pidfd;            // pidfd signalling the child's exit (-1 if unsupported)
+            uint64_t                                    m_read_token;       // Reactor registration of m_read_fd
+            uint64_t                                    m_pidfd_token;      // Reactor registration of m_pidfd
+            int                                         m_error_fd;         // Read end of the child's stderr pipe (-1 if none or drained)
+            uint64_t                                    m_error_token;      // Reactor registration of m_error_fd
+            bool                                        m_exited;           // Child has been reaped
+            bool                                        m_pipe_closed;      // Output pipe reached end-of-file
+            int                                         m_log_fd;           // Log file written with splice (-1 if unused)
+            int                                         m_tee_read_fd;      // Read end of the pipe tee() duplicates output into
+            int                                         m_tee_write_fd;     // Write end of that pipe
+            size_t                                      m_tee_pending;      // Bytes already logged but not read into m_output yet
+            bool                                        m_spliced;          // Output has reached the log through splice
+            SpawnServer*                                p_spawn_server;     // Helper that spawned and reaps the child (nullptr: our own child)
+            uint64_t                                    m_timeout_timer;    // Reactor timer of m_timeout (0 if none)
+            uint64_t                                    m_idle_timer;       // Reactor timer of m_idle_timeout (0 if none)
+            uint64_t                                    m_kill_timer;       // Reactor timer sending SIGKILL after the grace period (0 if none)
+            // Queued write to the child's stdin
+            struct StdinChunk {
+                std::string                             owned;              // Copy of the data (write_stdin(std::string))
+                const char*                             data;               // Next byte to write
+                size_t                                  size;               // Bytes left
+                std::function<void(bool)>               on_done;            // Called once written (true) or dropped (false)
+            };
+            int                                         m_stdin_fd;         // Write end of the child's stdin pipe, non-blocking (-1 if none)
+            uint64_t                                    m_stdin_token;      // Reactor registration of m_stdin_fd while a write waits for room
+            std::deque<StdinChunk>                      m_stdin_queue;      // Writes not done yet (m_mutex; only the loop thread pops)
+            bool                                        m_stdin_closing;    // close_stdin() called: close once the queue is empty (m_mutex)
+            bool                                        m_stdin_posted;     // A flush task is pending on the reactor (m_mutex)
+#endif
+            std::chrono::steady_clock::time_point       m_last_output;      // When output last arrived (idle timeout)
+            Exit_                                       m_stop_reason;      // Timeout that stopped the child (Exit_None if none)
+            std::shared_ptr<const Environment>          m_env_base;         // Parent environment, shared by every process
+            std::map<std::string,std::string>           m_env_var;          // Variables set or overridden on top of m_env_base
+            uint64_t                                    m_log_token;        // LogWriter file while the process runs (0 if none)
+            std::mutex                                  m_mutex;            // Guards the completion handshake
+            std::condition_variable                     m_cv;               // Signalled when the process completes
+            std::atomic<uint32_t>                       m_state_changes;    // Bumped by every set_state(): what wait_for_state() sleeps on
+            std::function<void()>                       m_on_complete;      // Hook run after completion (used by the manager)
+            std::chrono::steady_clock::time_point       m_dequeued;         // When the manager gave it a job slot (origin of m_run_time)
+            std::function<void(const RunResult&)>       m_on_result;        // One-shot hook run after completion (start_future(), run())
             // apis
-            void                                        monitor();          // Function to monitor process output
             void                                        execute();          // Function to execute process
+            void                                        complete();         // Close the log, then publish()
+            void                                        publish();          // Publish completion and wake waiters
+            void                                        set_state(Subprocess_ state); // Store m_state and wake its waiters (takes m_mutex)
+            RunResult                                   make_result();      // m_return_code, m_exit_reason and m_duration as a RunResult
+            void                                        commit_output(Stream_ stream, size_t size); // Commit a read into its buffer and record the arrival order
+            void                                        finish_output(Stream_ stream); // End of a stream: finish its buffer
+            void                                        deliver_output(Stream_ stream, const OutputBuffer& buffer); // Hand the last commit to m_on_chunk and m_on_line
+            void                                        queue_stdin(std::string owned, const char* data, size_t size, std::function<void(bool)> on_done); // Common part of the write_stdin() overloads
+#ifdef _WIN32
+            void                                        monitor();          // Function to monitor process output
+            void                                        record_usage();     // Fill m_end_time, m_duration and m_usage of the exited process
+            void                                        check_timeouts();   // Terminate the child once a timeout expired (timer thread)
+            static VOID CALLBACK                        on_timer(PVOID context, BOOLEAN fired); // Timer queue callback
+            void                                        kill_process();     // TerminateProcess() a running child
+            void                                        read_errors();      // Drain the stderr pipe (p_error_thread)
+#else
+            void                                        on_output();        // Drain the output pipe (reactor thread)
+            void                                        on_error_output();  // Drain the stderr pipe (reactor thread)
+            void                                        on_exit();          // Reap the child (reactor thread)
+            void                                        close_output();     // Stop watching the drained output pipe
+            bool                                        reap(bool block);   // wait4 wrapper, true once reaped
+            void                                        set_exit_status(int status, const struct rusage* usage); // Record a wait status and the child's rusage
+            void                                        open_log();         // Open m_log_path for splice or the LogWriter
+            ssize_t                                     splice_log();       // Move (or tee) pipe output into m_log_fd
+            void                                        close_splice();     // Close the splice descriptors
+            void                                        try_complete();     // Complete once reaped and drained
+            void                                        arm_timers();       // Start the timeout timers (reactor thread)
+            void                                        on_idle_timer();    // Stop the child or re-arm after the last output (reactor thread)
+            void                                        stop(Exit_ reason); // SIGTERM now, SIGKILL after m_kill_grace (reactor thread)
+            void                                        send_signal(int sig); // Signal the child's process group, or the child through its pidfd (reactor thread)
+            void                                        kill_process();     // SIGKILL a running child and its group (reactor thread)
+            void                                        cancel_timers();    // Drop the pending timers (reactor thread)
+            void                                        post_stdin();       // Schedule flush_stdin() once (m_mutex held)
+            void                                        flush_stdin();      // Write queued stdin data until the pipe is full (reactor thread)
+            void                                        drop_stdin();       // Close the stdin pipe and fail the queued writes (reactor thread)
+#endif
         public:
             // parameters
             std::string                                 m_name;             // Name of the process
             std::string                                 m_command;          // Command to be executed
             std::string                                 m_curr_directory;   // Current working directory of the process
             std::string                                 m_log_path;         // Log file path
-            std::string                                 m_output_str;       // String representation of process output
-            std::vector<std::string>                    m_output;           // Vector to store process output lines
-            double                                      m_duration;         // Duration of the process
+            LogPolicy                                   m_log_policy;       // When output is written to m_log_path
+            Redirect                                    m_stdin;            // Child's standard input
+            Redirect                                    m_stdout;           // Child's standard output (m_output and the log need Redirect_Pipe)
+            Redirect                                    m_stderr;           // Child's standard error
+            ResourceLimits                              m_limits;           // setrlimit() values for the child (POSIX)
+            std::vector<int>                            m_cpus;             // CPUs the child may run on, set before exec (empty: inherit)
+            int                                         m_numa_node;        // Run on the CPUs of this NUMA node when m_cpus is empty (-1: inherit, Linux)
+            double                                      m_timeout;          // Seconds the child may run before it is stopped (0: no limit)
+            double                                      m_idle_timeout;     // Seconds without output before the child is stopped (0: no limit, needs a piped stdout)
+            double                                      m_kill_grace;       // Seconds from SIGTERM to SIGKILL when a timeout stops the child (POSIX, default 5)
+            bool                                        m_new_group;        // Lead a new process group that signals reach as a whole (POSIX, default true)
+            OutputBuffer                                m_output;           // Captured output (full text and lines)
+            OutputBuffer                                m_error_output;     // Captured stderr (needs a Redirect_Pipe stderr)
+            bool                                        m_record_order;     // Keep m_output_order while both streams are piped (default false)
+            std::vector<OutputRecord>                   m_output_order;     // Arrival order of the reads, consecutive reads of a stream merged
+            std::function<void(Stream_, std::string_view)> m_on_chunk;      // Each read as it arrives, a view into the buffer (I/O thread)
+            std::function<void(Stream_, std::string_view)> m_on_line;       // Each completed line, without its newline (I/O thread)
+            std::function<void(Subprocess&)>            m_on_exit;          // Once exited and drained, before join() returns (I/O thread)
+            std::chrono::steady_clock::time_point       m_start_time;       // When the process was started
+            std::chrono::steady_clock::time_point       m_end_time;         // When its exit was observed
+            double                                      m_duration;         // Wall time in seconds, m_end_time - m_start_time
+            ResourceUsage                               m_usage;            // CPU, memory and I/O counters of the child
             int                                         m_process_id;       // Process ID
             int                                         m_return_code;      // Return code of the process
-            Subprocess_                                 m_state;            // State of the process
+            Exit_                                       m_exit_reason;      // How the process ended
+            std::atomic<Subprocess_>                    m_state;            // State of the process (block on it with wait_for_state())
+            int                                         m_priority;         // Start order under Schedule_Priority (higher first)
+            double                                      m_estimate;         // Expected run time in seconds, weighs Schedule_CriticalPath (default 1)
+            std::vector<std::string>                    m_depends_on;       // Names of the processes that must complete first (manager)
+            double                                      m_queue_wait;       // Seconds spent waiting for a manager job slot
+            double                                      m_run_time;         // Seconds from leaving the manager queue to completion
+            std::string                                 m_error;            // Why the manager did not start the process ("" if it did)
             // apis
             Subprocess*                                 start();            // Function to start the process
             Subprocess*                                 start_async();      // Function to start the process asynchronosly
-            Subprocess*                                 terminate();        // Function to terminate the process
+            std::future<RunResult>                      start_future();     // start_async(), returning a future that is ready once the process completed
+            RunAwaitable                                run();              // co_await run(): start, and resume the coroutine once the process completed
+            Subprocess*                                 terminate();        // Kill the process (and its process group) if running, then wait for it
             Subprocess*                                 join();             // Function to join the monitoring thread
+            Subprocess_                                 wait_for_state(Subprocess_ state); // Sleep until m_state reaches state or a later one, or its start failed (Subprocess_NotStarted); returns the state seen
+            bool                                        wait_until(Subprocess_ state, std::chrono::steady_clock::time_point deadline); // wait_for_state() with a deadline, false if it passed first or the start failed
+            Subprocess*                                 write_stdin(std::string data, std::function<void(bool written)> on_done = nullptr); // Queue a copy of data for the child's stdin (needs a Redirect_Pipe stdin)
+            Subprocess*                                 write_stdin(const char* data, size_t size, std::function<void(bool written)> on_done = nullptr); // Queue a caller owned buffer, which must live until on_done
+            Subprocess*                                 close_stdin();      // End of input once the queued writes are done
+            std::string                                 merged_output() const; // stdout and stderr interleaved as in m_output_order
             Subprocess( std::string name,
                         std::string command,
                         std::string curr_directory="",
                         std::string log_path="",
-                        std::map<std::string,std::string> env_var={{}});    // Constructor
+                        std::map<std::string,std::string> env_var={{}},
+                        Redirect stdin_redirect=Redirect_Null,
+                        Redirect stdout_redirect=Redirect_Pipe,
+                        Redirect stderr_redirect=Redirect_Inherit,
+                        ResourceLimits limits=ResourceLimits());            // Constructor
             ~Subprocess();                                                  // Destructor
+            friend class SubprocessManager;
+            friend class RunAwaitable;
     };
 
     class SubprocessManager {
         private:
-            std::thread*                                p_monitor_thread;   // Pointer to the monitoring thread
-            void                                        monitor();          // Function to monitor subprocesses
+            std::mutex                                  m_mutex;            // Guards the scheduling state and m_state transitions
+            std::condition_variable                     m_cv;               // Signalled when the last process completes
+            using Clock = std::chrono::steady_clock;
+            // Queued process; the top of m_ready is started next
+            struct Ready {
+                double                                  priority;           // Schedule key (higher first), 0 under Schedule_FIFO
+                size_t                                  index;              // Position in m_processes (ties: lower first)
+                bool operator<(const Ready& other) const { return priority != other.priority ? priority < other.priority : index > other.index; }
+            };
+            // Scheduling state of one run, indexed by task id (the position in
+            // m_processes), one array per field: a pass over the tasks reads
+            // only the fields it needs instead of a whole Subprocess each. The
+            // configuration (commands, environment, buffers) stays in the
+            // Subprocess objects.
+            struct TaskTable {
+                std::vector<uint8_t>                    state;              // Subprocess_ as seen by the manager
+                std::vector<int>                        return_code;        // m_return_code once completed (-1: not run)
+                std::vector<int>                        process_id;         // m_process_id once started (-1: not started)
+                std::vector<uint8_t>                    skipped;            // A dependency failed or terminate(): never started
+                std::vector<uint32_t>                   waiting;            // Dependencies not completed yet
+                std::vector<int>                        target;             // Index in m_targets it was placed on (-1: not placed)
+                std::vector<double>                     priority;           // Schedule key (higher first), 0 under Schedule_FIFO
+                std::vector<uint32_t>                   dependents_begin;   // Dependents of task i are dependents[dependents_begin[i], dependents_begin[i + 1])
+                std::vector<uint32_t>                   dependents;         // Tasks waiting for each task, grouped by task
+                void                                    assign(size_t count); // Size every per-task array for count tasks, in the initial state
+            };
+            size_t                                      m_remaining;        // Processes that have not completed yet
+            size_t                                      m_running;          // Processes holding a job slot
+            std::priority_queue<Ready>                  m_ready;            // Processes waiting for a job slot
+            TaskTable                                   m_tasks;            // Scheduling state and dependency graph, built by execute()
+            std::unordered_map<std::string,size_t>      m_index;            // Position in m_processes by name
+            std::vector<int>                            m_targets;          // CPUs or NUMA nodes used by m_placement
+            std::vector<size_t>                         m_target_load;      // Running processes placed on each target
+            size_t                                      m_next_target;      // Round-robin cursor into m_targets
+            Clock::time_point                           m_start;            // When execute() queued the processes
+            bool                                        m_terminating;      // terminate() called: queued processes are dropped
+            size_t                                      m_starting;         // schedule() passes starting claimed processes outside the lock
             void                                        execute();          // Function to execute subprocesses
+            void                                        enqueue(size_t index); // Queue a process whose dependencies completed (lock held)
+            void                                        place(size_t index); // Pin a claimed process to the next least loaded target (lock held)
+            void                                        build_graph();      // Resolve m_depends_on into m_tasks, throws on unknown names and cycles
+            void                                        schedule(std::vector<size_t> completed); // Record completed processes, release them and start ready ones into free slots
+            void                                        set_state(Subprocess_ state); // Store m_state and wake its waiters (lock held)
         public:
             std::vector<Subprocess*>                    m_processes;        // Vector to store subprocesses
-            Subprocess_                                 m_state;    // State of the manager
+            std::atomic<Subprocess_>                    m_state;            // State of the manager (block on it with wait_for_state())
+            size_t                                      m_max_running;      // Job slots: processes running at once (default: hardware threads, 0: unlimited)
+            Schedule_                                   m_schedule;         // Order in which queued processes take a free slot (default: Schedule_CriticalPath)
+            double                                      m_makespan;         // Seconds from start to the last completion
+            Placement_                                  m_placement;        // Fills m_cpus / m_numa_node of processes that set neither
+            ResourceUsage                               m_usage;            // m_usage of every completed process added up
             int                                         find(std::string name); // Find a subprocess by name
+            size_t                                      count(Subprocess_ state); // Subprocesses of the current run in state, from the task table
+            std::vector<size_t>                         failed();           // Positions of the subprocesses that exited non-zero or were skipped so far, and that did not start once completed
+            SubprocessManager*                          depends_on(std::string name, std::vector<std::string> dependencies); // Start name only after dependencies completed successfully
             SubprocessManager*                          start();            // Function to start the manager and its subprocesses
             SubprocessManager*                          start_async();      // Function to start the manager and its subprocesses asynchronously
-            SubprocessManager*                          terminate();        // Function to terminate all subprocesses
+            SubprocessManager*                          terminate();        // Drop queued subprocesses, kill the running ones, then wait for them
             SubprocessManager*                          join();             // Function to join the monitoring thread
+            Subprocess_                                 wait_for_state(Subprocess_ state); // Sleep until m_state reaches state or a later one, returns the state seen
+            bool                                        wait_until(Subprocess_ state, std::chrono::steady_clock::time_point deadline); // wait_for_state() with a deadline, false if it passed first
             Subprocess*                                 operator[](std::string name); // Access a subprocess by name
             SubprocessManager*                          add(Subprocess* process); // Add a subprocess
             SubprocessManager*                          add(std::string name,
                                                             std::string command,
                                                             std::string curr_directory="",
                                                             std::string log_path="",
-                                                            std::map<std::string,std::string> env_var={{}}); // Add a subprocess
+                                                            std::map<std::string,std::string> env_var={{}},
+                                                            Redirect stdin_redirect=Redirect_Null,
+                                                            Redirect stdout_redirect=Redirect_Pipe,
+                                                            Redirect stderr_redirect=Redirect_Inherit,
+                                                            ResourceLimits limits=ResourceLimits()); // Add a subprocess
+            static void                                 start_spawn_server(); // Spawn children from a helper forked now (POSIX; call early, while the process is small)
             SubprocessManager();                                            // Constructor
             ~SubprocessManager();                                           // Destructor
     };
@@ -0,0 +1,91 @@
+#include "affinity.h"
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+using namespace subprocess_manager;
+
+std::vector<int> subprocess_manager::parse_cpu_list(const std::string& list){
+    std::vector<int> cpus;
+    size_t position = 0;
+    while(position < list.size() && list[position] != '\n'){
+        size_t used = 0;
+        int first;
+        int last;
+        try{
+            first = std::stoi(list.substr(position), &used);
+        }catch(...){
+            return {};
+        }
+        position += used;
+        last = first;
+        if(position < list.size() && list[position] == '-'){
+            try{
+                last = std::stoi(list.substr(position + 1), &used);
+            }catch(...){
+                return {};
+            }
+            position += used + 1;
+        }
+        for(int cpu = first; cpu <= last; cpu++){
+            cpus.push_back(cpu);
+        }
+        if(position < list.size() && list[position] == ','){
+            position++;
+        }
+    }
+    return cpus;
+}
+#ifdef __linux__
+static std::string ReadLine(const std::string& path){
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+#endif
+std::vector<int> subprocess_manager::allowed_cpus(){
+    std::vector<int> cpus;
+#ifdef _WIN32
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if(GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)){
+        for(int cpu = 0; cpu < (int)(sizeof(DWORD_PTR) * 8); cpu++){
+            if(process_mask & ((DWORD_PTR)1 << cpu)){
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    if(sched_getaffinity(0, sizeof(set), &set) == 0){
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+            if(CPU_ISSET(cpu, &set)){
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+std::vector<int> subprocess_manager::numa_nodes(){
+    std::vector<int> nodes;
+#ifdef __linux__
+    for(int node : parse_cpu_list(ReadLine("/sys/devices/system/node/online"))){
+        if(!numa_node_cpus(node).empty()){
+            nodes.push_back(node);
+        }
+    }
+#endif
+    return nodes;
+}
+std::vector<int> subprocess_manager::numa_node_cpus(int node){
+#ifdef __linux__
+    if(node >= 0){
+        return parse_cpu_list(ReadLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+    }
+#endif
+    return {};
+}
@@ -0,0 +1,14 @@
+#ifndef AFFINITY_H                 // Include guard to prevent multiple definitions
+#define AFFINITY_H
+#include <string>               // For CPU list parsing
+#include <vector>               // For CPU and node lists
+namespace subprocess_manager {
+    // CPU and NUMA topology as seen by this process. Nodes come from sysfs
+    // (/sys/devices/system/node), so no libnuma is needed; where that is not
+    // available every query returns an empty list.
+    std::vector<int>                                    allowed_cpus();     // CPUs this process may run on
+    std::vector<int>                                    numa_nodes();       // Online NUMA nodes that have CPUs
+    std::vector<int>                                    numa_node_cpus(int node); // CPUs of a node, empty if unknown
+    std::vector<int>                                    parse_cpu_list(const std::string& list); // "0-3,8" -> {0,1,2,3,8}, empty if malformed
+}
+#endif // AFFINITY_H
@@ -0,0 +1,145 @@
+#include "environment.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#ifdef _WIN32
+#include <windows.h>
+#else
+extern char **environ;
+#endif
+using namespace subprocess_manager;
+
+std::shared_ptr<const Environment> Environment::snapshot(){
+    static std::once_flag once;
+    static std::shared_ptr<const Environment> environment;
+    std::call_once(once, [](){
+#ifdef _WIN32
+        std::vector<const char*> envp;
+        LPCH block = GetEnvironmentStrings();
+        for(LPCH entry = block; entry != nullptr && *entry != '\0'; entry += strlen(entry) + 1){
+            envp.push_back(entry);
+        }
+        envp.push_back(nullptr);
+        environment = std::make_shared<const Environment>(envp.data());
+        if(block != nullptr){
+            FreeEnvironmentStrings(block);
+        }
+#else
+        environment = std::make_shared<const Environment>(environ);
+#endif
+    });
+    return environment;
+}
+Environment::Environment(const char* const* envp){
+    size_t total = 0;
+    for(const char* const* entry = envp; entry != nullptr && *entry != nullptr; entry++){
+        total += strlen(*entry) + 1;
+    }
+    this->m_text.reserve(total);
+    for(const char* const* entry = envp; entry != nullptr && *entry != nullptr; entry++){
+        std::string_view text(*entry);
+        // Windows keeps per-drive directories as "=C:=C:\..."; the name
+        // ends at the first '=' after the first character
+        size_t name_size = text.find('=', 1);
+        if(name_size == std::string_view::npos){
+            continue;
+        }
+        Entry added;
+        added.offset = this->m_text.size();
+        added.name_size = name_size;
+        added.size = text.size();
+        this->m_text.append(text);
+        this->m_text.push_back('\0');
+        this->m_entries.push_back(added);
+    }
+    // stable: the first of duplicate names wins, as with getenv()
+    std::stable_sort(this->m_entries.begin(), this->m_entries.end(), [this](const Entry& a, const Entry& b){
+        return this->name(a) < this->name(b);
+    });
+    this->m_entries.erase(std::unique(this->m_entries.begin(), this->m_entries.end(), [this](const Entry& a, const Entry& b){
+        return this->name(a) == this->name(b);
+    }), this->m_entries.end());
+}
+std::string_view Environment::name(const Entry& entry) const{
+    return std::string_view(this->m_text.data() + entry.offset, entry.name_size);
+}
+size_t Environment::size() const{
+    return this->m_entries.size();
+}
+EnvironmentBlock Environment::build(const std::map<std::string,std::string>& overlay) const{
+    // Merge the sorted snapshot with the sorted overlay twice: once to size
+    // the block, once to fill it.
+    size_t text_size = 0;
+    auto merge = [&](auto&& base, auto&& extra){
+        auto entry = this->m_entries.begin();
+        auto variable = overlay.begin();
+        while(entry != this->m_entries.end() || variable != overlay.end()){
+            if(variable != overlay.end() && variable->first.empty()){
+                variable++;
+                continue;
+            }
+            int order = entry == this->m_entries.end() ? 1
+                      : variable == overlay.end() ? -1
+                      : this->name(*entry).compare(variable->first);
+            if(order < 0){
+                base(*entry);
+                entry++;
+            }else{
+                if(order == 0){
+                    entry++;
+                }
+                extra(variable->first, variable->second);
+                variable++;
+            }
+        }
+    };
+    EnvironmentBlock block;
+#ifdef _WIN32
+    // One contiguous, sorted, double null terminated block
+    merge([&](const Entry& entry){ text_size += entry.size + 1; },
+          [&](const std::string& name, const std::string& value){ text_size += name.size() + value.size() + 2; });
+    block.memory.reset(new char[text_size + 2]);
+    block.envp = nullptr;
+    block.text = block.memory.get();
+    char* out = block.text;
+    merge([&](const Entry& entry){
+              memcpy(out, this->m_text.data() + entry.offset, entry.size + 1);
+              out += entry.size + 1;
+          },
+          [&](const std::string& name, const std::string& value){
+              memcpy(out, name.data(), name.size());
+              out += name.size();
+              *out++ = '=';
+              memcpy(out, value.c_str(), value.size() + 1);
+              out += value.size() + 1;
+          });
+    // an empty block still needs two terminators
+    *out++ = '\0';
+    *out = '\0';
+#else
+    // Pointer array followed by the overlay's text; snapshot entries are
+    // referenced in place
+    size_t count = 0;
+    merge([&](const Entry&){ count++; },
+          [&](const std::string& name, const std::string& value){
+              count++;
+              text_size += name.size() + value.size() + 2;
+          });
+    block.memory.reset(new char[(count + 1) * sizeof(char*) + text_size]);
+    block.envp = reinterpret_cast<char**>(block.memory.get());
+    block.text = nullptr;
+    char** pointer = block.envp;
+    char* out = block.memory.get() + (count + 1) * sizeof(char*);
+    merge([&](const Entry& entry){ *pointer++ = const_cast<char*>(this->m_text.data() + entry.offset); },
+          [&](const std::string& name, const std::string& value){
+              *pointer++ = out;
+              memcpy(out, name.data(), name.size());
+              out += name.size();
+              *out++ = '=';
+              memcpy(out, value.c_str(), value.size() + 1);
+              out += value.size() + 1;
+          });
+    *pointer = nullptr;
+#endif
+    return block;
+}
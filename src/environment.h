@@ -0,0 +1,38 @@
+#ifndef ENVIRONMENT_H              // Include guard to prevent multiple definitions
+#define ENVIRONMENT_H
+#include <cstddef>              // For size_t
+#include <map>                  // For per-process overlays
+#include <memory>               // For the shared snapshot and the block storage
+#include <string>               // For the snapshot text
+#include <string_view>          // For variable names
+#include <vector>               // For the entry index
+namespace subprocess_manager {
+    // Environment handed to a child: the shared snapshot merged with the
+    // variables a Subprocess overrides, in one allocation.
+    struct EnvironmentBlock {
+        std::unique_ptr<char[]>                         memory;             // Owns everything below
+        char**                                          envp;               // Null terminated NAME=VALUE pointers (POSIX)
+        char*                                           text;               // Double null terminated NAME=VALUE block (Windows)
+    };
+    // Immutable copy of the parent's environment, taken once and shared by
+    // every Subprocess. Entries are stored back to back in one string and
+    // indexed by name, so a child's environment is assembled by merging the
+    // index with a small overlay instead of re-parsing the environment.
+    class Environment {
+        public:
+            static std::shared_ptr<const Environment>   snapshot();         // Process environment, captured on first use
+            EnvironmentBlock                            build(const std::map<std::string,std::string>& overlay) const; // Snapshot with overlay applied
+            size_t                                      size() const;       // Number of variables
+            Environment(const char* const* envp);                           // From a null terminated NAME=VALUE array
+        private:
+            struct Entry {
+                size_t                                  offset;             // Start of NAME=VALUE in m_text
+                size_t                                  name_size;          // Length of NAME
+                size_t                                  size;               // Length of NAME=VALUE
+            };
+            std::string                                 m_text;             // NAME=VALUE\0... as captured
+            std::vector<Entry>                          m_entries;          // Sorted by name
+            std::string_view                            name(const Entry& entry) const; // NAME of an entry
+    };
+}
+#endif // ENVIRONMENT_H
@@ -0,0 +1,90 @@
+#include "line_scanner_kernel.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+using namespace subprocess_manager;
+
+// Bytes scanned per kernel call; line ends are staged in a stack array
+static const size_t SCAN_BLOCK = 4096;
+
+namespace subprocess_manager {
+#ifdef SUBPROCESS_MANAGER_AVX2
+    // Defined in line_scanner_avx2.cpp, compiled for AVX2
+    size_t scan_block_avx2(char* data, size_t size, size_t& r, size_t& w, size_t stop, unsigned filter,
+                           ScanState& state, uint32_t* line_ends, uint32_t base);
+#endif
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+namespace {
+    struct Sse2 {
+        static const size_t WIDTH = 16;
+        static __m128i load(const char* p){
+            return _mm_loadu_si128((const __m128i*)p);
+        }
+        static void store(char* p, __m128i v){
+            _mm_storeu_si128((__m128i*)p, v);
+        }
+        static uint32_t mask(__m128i v, char byte){
+            return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(byte)));
+        }
+    };
+}
+#endif
+
+ScanImpl_ subprocess_manager::scan_best_impl(){
+#ifdef SUBPROCESS_MANAGER_AVX2
+#if defined(__GNUC__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    static const bool avx2 = [](){
+        int info[4];
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+#endif
+    if(avx2){
+        return ScanImpl_AVX2;
+    }
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+    return ScanImpl_SSE2;
+#else
+    return ScanImpl_Scalar;
+#endif
+}
+
+size_t subprocess_manager::scan_lines(char* data, size_t size, unsigned filter, ScanState& state,
+                                      std::vector<uint32_t>& line_ends, uint32_t base, ScanImpl_ impl){
+    if(impl == ScanImpl_Auto){
+        static const ScanImpl_ best = scan_best_impl();
+        impl = best;
+    }
+    uint32_t ends[SCAN_BLOCK + 64];
+    size_t r = 0;
+    size_t w = 0;
+    while(r < size){
+        size_t stop = r + SCAN_BLOCK < size ? r + SCAN_BLOCK : size;
+        size_t count;
+        switch(impl){
+#ifdef SUBPROCESS_MANAGER_AVX2
+            case ScanImpl_AVX2:
+                count = scan_block_avx2(data, size, r, w, stop, filter, state, ends, base);
+                break;
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+            case ScanImpl_SSE2:
+                count = scan_kernel<Sse2>(data, size, r, w, stop, filter, state, ends, base);
+                break;
+#endif
+            default:
+                count = scan_kernel_scalar(data, size, r, w, stop, filter, state, ends, base);
+                break;
+        }
+        line_ends.insert(line_ends.end(), ends, ends + count);
+    }
+    if(state.pending_cr){
+        data[w] = '\r';
+    }
+    return w;
+}
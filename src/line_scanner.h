@@ -0,0 +1,28 @@
+#ifndef LINE_SCANNER_H           // Include guard to prevent multiple definitions
+#define LINE_SCANNER_H
+#include <cstddef>              // For size_t
+#include <cstdint>              // For fixed width integers
+#include <vector>               // For the line end index
+namespace subprocess_manager {
+    // State carried from one scanned chunk to the next so CRLF pairs and
+    // escape sequences split across reads are handled correctly.
+    struct ScanState {
+        uint8_t                                         ansi;               // Escape sequence parser state (0 = plain text)
+        bool                                            pending_cr;         // Chunk ended in '\r', held back until the next byte
+    };
+    enum ScanImpl_ {
+        ScanImpl_Auto,
+        ScanImpl_Scalar,
+        ScanImpl_SSE2,
+        ScanImpl_AVX2
+    };
+    // Filters data[0,size) in place according to filter (Filter_ bits from
+    // output_buffer.h) and appends base + offset of every '\n' of the filtered
+    // text to line_ends. Returns the filtered size. When state.pending_cr is
+    // set on return, a '\r' was held back and sits at data[returned size].
+    size_t scan_lines(char* data, size_t size, unsigned filter, ScanState& state,
+                      std::vector<uint32_t>& line_ends, uint32_t base,
+                      ScanImpl_ impl = ScanImpl_Auto);
+    ScanImpl_ scan_best_impl();                                             // Fastest implementation on this CPU
+}
+#endif // LINE_SCANNER_H
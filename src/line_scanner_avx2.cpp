@@ -0,0 +1,26 @@
+// AVX2 instantiation of the line scanner; this file is compiled with AVX2
+// enabled and only called after a runtime CPU check.
+#include "line_scanner_kernel.h"
+#include <immintrin.h>
+
+namespace {
+    struct Avx2 {
+        static const size_t WIDTH = 32;
+        static __m256i load(const char* p){
+            return _mm256_loadu_si256((const __m256i*)p);
+        }
+        static void store(char* p, __m256i v){
+            _mm256_storeu_si256((__m256i*)p, v);
+        }
+        static uint32_t mask(__m256i v, char byte){
+            return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(byte)));
+        }
+    };
+}
+
+namespace subprocess_manager {
+    size_t scan_block_avx2(char* data, size_t size, size_t& r, size_t& w, size_t stop, unsigned filter,
+                           ScanState& state, uint32_t* line_ends, uint32_t base){
+        return scan_kernel<Avx2>(data, size, r, w, stop, filter, state, line_ends, base);
+    }
+}
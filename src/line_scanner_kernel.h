@@ -0,0 +1,197 @@
+#ifndef LINE_SCANNER_KERNEL_H    // Include guard to prevent multiple definitions
+#define LINE_SCANNER_KERNEL_H
+// Shared body of the line scanner. Included by each translation unit that
+// provides an implementation (scalar/SSE2 in line_scanner.cpp, AVX2 in
+// line_scanner_avx2.cpp) and instantiated with that unit's vector type.
+// Everything lives in an anonymous namespace and no library templates are
+// instantiated here (line ends go to a plain array), so code compiled for
+// different instruction sets never gets merged by the linker.
+#include "line_scanner.h"
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+namespace subprocess_manager {
+namespace {
+    enum Ansi_ : uint8_t {
+        Ansi_Text,              // plain text
+        Ansi_Escape,            // after ESC
+        Ansi_Csi,               // ESC [ parameters... final
+        Ansi_Osc,               // ESC ] ... terminated by BEL or ST
+        Ansi_OscEscape,         // ESC inside an OSC string
+        Ansi_Intermediate       // ESC intermediates... final
+    };
+    const unsigned SCAN_FILTER_CRLF = 1;    // Filter_CRLF
+    const unsigned SCAN_FILTER_ANSI = 2;    // Filter_ANSI
+
+    inline unsigned scan_ctz(uint32_t mask){
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (unsigned)index;
+#else
+        return (unsigned)__builtin_ctz(mask);
+#endif
+    }
+    // Advance an escape sequence by one byte; false when the byte ends the
+    // sequence abnormally and must be treated as text.
+    inline bool scan_escape(ScanState& state, unsigned char c){
+        if(c == '\n'){
+            state.ansi = Ansi_Text;
+            return false;
+        }
+        switch(state.ansi){
+            case Ansi_Escape:
+                if(c == '['){
+                    state.ansi = Ansi_Csi;
+                }else if(c == ']'){
+                    state.ansi = Ansi_Osc;
+                }else if(c >= 0x20 && c <= 0x2F){
+                    state.ansi = Ansi_Intermediate;
+                }else{
+                    state.ansi = Ansi_Text;
+                }
+                return true;
+            case Ansi_Csi:
+                if(c >= 0x40 && c <= 0x7E){
+                    state.ansi = Ansi_Text;
+                }else if(c < 0x20){
+                    state.ansi = Ansi_Text;
+                    return false;
+                }
+                return true;
+            case Ansi_Osc:
+                if(c == 0x07){
+                    state.ansi = Ansi_Text;
+                }else if(c == 0x1B){
+                    state.ansi = Ansi_OscEscape;
+                }
+                return true;
+            case Ansi_OscEscape:
+                state.ansi = c == '\\' ? Ansi_Text : Ansi_Osc;
+                return true;
+            case Ansi_Intermediate:
+                if(c >= 0x30 && c <= 0x7E){
+                    state.ansi = Ansi_Text;
+                }else if(c < 0x20 || c > 0x2F){
+                    state.ansi = Ansi_Text;
+                    return false;
+                }
+                return true;
+        }
+        return true;
+    }
+    // Filter the byte at data[r] and emit it at data[w] if it is kept
+    inline void scan_byte(char* data, size_t size, size_t& r, size_t& w, unsigned filter,
+                          ScanState& state, uint32_t*& line_ends, uint32_t base){
+        unsigned char c = (unsigned char)data[r++];
+        if(state.ansi != Ansi_Text && scan_escape(state, c)){
+            return;
+        }
+        if(c == 0x1B && (filter & SCAN_FILTER_ANSI)){
+            state.ansi = Ansi_Escape;
+            return;
+        }
+        if(c == '\r' && (filter & SCAN_FILTER_CRLF)){
+            if(r == size){
+                state.pending_cr = true;
+                return;
+            }
+            if(data[r] == '\n'){
+                return;
+            }
+        }
+        data[w] = (char)c;
+        if(c == '\n'){
+            *line_ends++ = base + (uint32_t)w;
+        }
+        w++;
+    }
+    inline void scan_newlines(uint32_t mask, size_t offset, uint32_t*& line_ends, uint32_t base){
+        while(mask != 0){
+            *line_ends++ = base + (uint32_t)(offset + scan_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    // Scan data[r,stop) (data[stop,size) is only looked at for CRLF pairs).
+    // r and w are the read and write positions and carry over between calls;
+    // the vector loop may run up to V::WIDTH - 1 bytes past stop, so
+    // line_ends must have room for stop - r + V::WIDTH entries.
+    // Returns the number of line ends written.
+    // V provides: WIDTH, load(p), store(p, v), mask(v, byte) (movemask of v == byte)
+    template<typename V>
+    size_t scan_kernel(char* data, size_t size, size_t& r, size_t& w, size_t stop, unsigned filter,
+                       ScanState& state, uint32_t* line_ends, uint32_t base){
+        uint32_t* first_end = line_ends;
+        if(filter == 0){
+            // Nothing is rewritten: only newline positions are needed
+            for(; r + V::WIDTH <= size && r < stop; r += V::WIDTH){
+                scan_newlines(V::mask(V::load(data + r), '\n'), r, line_ends, base);
+            }
+            for(; r < stop; r++){
+                if(data[r] == '\n'){
+                    *line_ends++ = base + (uint32_t)r;
+                }
+            }
+            w = r;
+            return line_ends - first_end;
+        }
+        while(r < stop){
+            if(state.ansi == Ansi_Text && r + V::WIDTH <= size){
+                auto v = V::load(data + r);
+                uint32_t special = 0;
+                if(filter & SCAN_FILTER_CRLF){
+                    special |= V::mask(v, '\r');
+                }
+                if(filter & SCAN_FILTER_ANSI){
+                    special |= V::mask(v, 0x1B);
+                }
+                uint32_t newlines = V::mask(v, '\n');
+                if(special == 0){
+                    // Common case: a whole block of plain text
+                    if(w != r){
+                        V::store(data + w, v);
+                    }
+                    scan_newlines(newlines, w, line_ends, base);
+                    r += V::WIDTH;
+                    w += V::WIDTH;
+                    continue;
+                }
+                // Copy the plain prefix, then let the scalar path take the special byte
+                unsigned first = scan_ctz(special);
+                if(first != 0){
+                    if(w != r){
+                        std::memmove(data + w, data + r, first);
+                    }
+                    scan_newlines(newlines & ((1u << first) - 1), w, line_ends, base);
+                    r += first;
+                    w += first;
+                }
+            }
+            scan_byte(data, size, r, w, filter, state, line_ends, base);
+        }
+        return line_ends - first_end;
+    }
+    // Byte at a time reference implementation of scan_kernel
+    inline size_t scan_kernel_scalar(char* data, size_t size, size_t& r, size_t& w, size_t stop, unsigned filter,
+                                     ScanState& state, uint32_t* line_ends, uint32_t base){
+        uint32_t* first_end = line_ends;
+        if(filter == 0){
+            const char* found;
+            while(r < stop && (found = (const char*)std::memchr(data + r, '\n', stop - r)) != nullptr){
+                r = found - data;
+                *line_ends++ = base + (uint32_t)r;
+                r++;
+            }
+            r = stop;
+            w = r;
+            return line_ends - first_end;
+        }
+        while(r < stop){
+            scan_byte(data, size, r, w, filter, state, line_ends, base);
+        }
+        return line_ends - first_end;
+    }
+}
+}
+#endif // LINE_SCANNER_KERNEL_H
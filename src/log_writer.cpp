@@ -0,0 +1,175 @@
+#include "log_writer.h"
+#include <vector>
+using namespace subprocess_manager;
+
+// Pending output that is written regardless of the policy, bounding memory
+// when a child outpaces LogFlush_Exit or a long interval
+static const size_t LOG_WRITER_MAX_PENDING = 4 * 1024 * 1024;
+
+LogWriter& LogWriter::instance(){
+    static LogWriter writer;
+    return writer;
+}
+LogWriter::LogWriter(){
+    this->m_stop = false;
+    this->m_next_token = 1;
+    this->m_wakeup = (Clock::time_point::max)();
+    this->m_thread = std::thread(&LogWriter::run, this);
+}
+LogWriter::~LogWriter(){
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_stop = true;
+    }
+    this->m_cv.notify_all();
+    if(this->m_thread.joinable()){
+        this->m_thread.join();
+    }
+}
+uint64_t LogWriter::open(const std::string& path, const LogPolicy& policy, bool append){
+    std::unique_ptr<File> file(new File());
+    file->stream.open(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+    if(!file->stream.is_open()){
+        return 0;
+    }
+    file->policy = policy;
+    file->closing = false;
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    uint64_t token = this->m_next_token++;
+    this->m_files[token] = std::move(file);
+    return token;
+}
+void LogWriter::write(uint64_t token, const char* data, size_t size){
+    if(token == 0 || size == 0){
+        return;
+    }
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        auto found = this->m_files.find(token);
+        if(found == this->m_files.end()){
+            return;
+        }
+        File& file = *found->second;
+        // only wake the writer when this write changes its schedule
+        bool was_due = !file.pending.empty() && this->due(file, (Clock::time_point::min)());
+        if(file.pending.empty()){
+            file.since = Clock::now();
+        }
+        file.pending.append(data, size);
+        wake = (!was_due && this->due(file, (Clock::time_point::min)())) || this->deadline(file) < this->m_wakeup;
+    }
+    if(wake){
+        this->m_cv.notify_one();
+    }
+}
+void LogWriter::close(uint64_t token, std::function<void()> on_closed){
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        auto found = this->m_files.find(token);
+        if(found != this->m_files.end()){
+            found->second->closing = true;
+            found->second->on_closed = std::move(on_closed);
+            // notified under the lock: on_closed may let the program exit
+            // and destroy this writer as soon as the writer thread runs it
+            this->m_cv.notify_one();
+            return;
+        }
+    }
+    if(on_closed){
+        on_closed();
+    }
+}
+bool LogWriter::due(const File& file, Clock::time_point now) const{
+    if(file.closing){
+        return true;
+    }
+    if(file.pending.empty()){
+        return false;
+    }
+    if(file.pending.size() >= LOG_WRITER_MAX_PENDING){
+        return true;
+    }
+    switch(file.policy.flush){
+        case LogFlush_Size:
+            return file.pending.size() >= file.policy.bytes;
+        case LogFlush_Interval:
+            return now >= this->deadline(file);
+        default:
+            return false;
+    }
+}
+LogWriter::Clock::time_point LogWriter::deadline(const File& file) const{
+    if(file.policy.flush != LogFlush_Interval || file.pending.empty()){
+        return (Clock::time_point::max)();
+    }
+    return file.since + std::chrono::milliseconds(file.policy.interval_ms);
+}
+void LogWriter::run(){
+    struct Batch {
+        File*                                   file;
+        std::string                             data;
+        uint64_t                                token;
+    };
+    std::vector<Batch> batch;
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    while(true){
+        // collect every due file in one pass (group commit)
+        Clock::time_point now = Clock::now();
+        this->m_wakeup = (Clock::time_point::max)();
+        for(auto& entry : this->m_files){
+            File& file = *entry.second;
+            if(this->due(file, now) || (this->m_stop && !file.pending.empty())){
+                Batch item;
+                item.file = &file;
+                item.data.swap(file.pending);
+                item.token = file.closing ? entry.first : 0;
+                batch.push_back(std::move(item));
+            }else if(this->deadline(file) < this->m_wakeup){
+                this->m_wakeup = this->deadline(file);
+            }
+        }
+        if(batch.empty()){
+            if(this->m_stop){
+                break;
+            }
+            if(this->m_wakeup == (Clock::time_point::max)()){
+                this->m_cv.wait(lock);
+            }else{
+                this->m_cv.wait_until(lock, this->m_wakeup);
+            }
+            continue;
+        }
+        // Files are only removed by this thread, so they stay valid while
+        // the lock is released for the actual I/O.
+        lock.unlock();
+        std::vector<std::function<void()>> closed;
+        for(Batch& item : batch){
+            if(!item.data.empty()){
+                item.file->stream.write(item.data.data(), (std::streamsize)item.data.size());
+                item.file->stream.flush();
+            }
+            if(item.token != 0){
+                item.file->stream.close();
+            }
+        }
+        lock.lock();
+        for(Batch& item : batch){
+            if(item.token != 0){
+                auto found = this->m_files.find(item.token);
+                if(found->second->on_closed){
+                    closed.push_back(std::move(found->second->on_closed));
+                }
+                this->m_files.erase(found);
+            }
+        }
+        batch.clear();
+        lock.unlock();
+        for(std::function<void()>& on_closed : closed){
+            on_closed();
+        }
+        lock.lock();
+    }
+    // files never closed by their owner are flushed by their destructors
+    this->m_files.clear();
+}
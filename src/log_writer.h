@@ -0,0 +1,52 @@
+#ifndef LOG_WRITER_H               // Include guard to prevent multiple definitions
+#define LOG_WRITER_H
+#include <subprocess_manager.h> // For LogPolicy
+#include <chrono>               // For flush deadlines
+#include <condition_variable>   // For waking the writer thread
+#include <cstdint>              // For fixed width integers
+#include <fstream>              // For the log files
+#include <functional>           // For close callbacks
+#include <memory>               // For file ownership
+#include <mutex>                // For guarding the file table
+#include <string>               // For pending output
+#include <thread>               // For the writer thread
+#include <unordered_map>        // For the file table
+namespace subprocess_manager {
+    // Single background thread that writes every Subprocess log file.
+    //
+    // Readers only append to an in-memory buffer per file; the writer thread
+    // picks up every file that is due under its LogPolicy, swaps the buffers
+    // out and writes each with one call, so a slow disk never stalls the
+    // threads draining child pipes and output of many children is committed
+    // in one pass.
+    class LogWriter {
+        public:
+            using Clock = std::chrono::steady_clock;
+            static LogWriter&                           instance();         // Lazily started process wide writer
+            uint64_t                                    open(const std::string& path, const LogPolicy& policy, bool append = false); // Truncate (or append to) and open path, 0 on failure
+            void                                        write(uint64_t token, const char* data, size_t size); // Queue data for the file
+            void                                        close(uint64_t token, std::function<void()> on_closed = nullptr); // Write the rest and close, then call on_closed (writer thread)
+        private:
+            struct File {
+                std::ofstream                           stream;             // Open log file
+                LogPolicy                               policy;             // When pending output is written
+                std::string                             pending;            // Output not written yet
+                Clock::time_point                       since;              // Arrival of the oldest pending byte
+                bool                                    closing;            // close() was called
+                std::function<void()>                   on_closed;          // Run once the file is closed
+            };
+            std::mutex                                  m_mutex;            // Guards the state below
+            std::condition_variable                     m_cv;               // Signalled when a file may have become due
+            bool                                        m_stop;             // Set by the destructor
+            uint64_t                                    m_next_token;       // Next file token
+            Clock::time_point                           m_wakeup;           // Time the writer sleeps until
+            std::unordered_map<uint64_t,std::unique_ptr<File>> m_files;    // Open files by token
+            std::thread                                 m_thread;           // Writer thread
+            bool                                        due(const File& file, Clock::time_point now) const; // Should file be written now
+            Clock::time_point                           deadline(const File& file) const; // When file becomes due by time
+            void                                        run();              // Writer loop
+            LogWriter();                                                    // Constructor
+            ~LogWriter();                                                   // Destructor
+    };
+}
+#endif // LOG_WRITER_H
@@ -0,0 +1,591 @@
+#include <output_buffer.h>
+#include "line_scanner.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+using namespace subprocess_manager;
+
+// Start a new chunk once less than this is left for a read
+static const size_t OUTPUT_BUFFER_MIN_FREE = 1024;
+// Smallest segment used by the tail modes
+static const size_t OUTPUT_BUFFER_MIN_SEGMENT = 16 * 1024;
+// Line ends are 32 bit offsets inside a chunk
+static_assert(OutputBuffer::CHUNK_SIZE <= UINT32_MAX, "chunks must stay addressable by the line index");
+
+// Lines of unfiltered CRLF output still end in '\r'
+static std::string_view TrimCR(std::string_view line){
+    if(!line.empty() && line.back() == '\r'){
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+OutputBuffer::OutputBuffer(){
+    this->m_line_base = 0;
+    this->m_line_start = 0;
+    this->m_line_offset = 0;
+    this->m_size = 0;
+    this->m_finished = false;
+    this->m_filter = Filter_None;
+    this->m_scan_ansi = 0;
+    this->m_pending_cr = false;
+    this->m_recent_begin = 0;
+    this->m_recent_size = 0;
+    this->m_recent_line = 0;
+    this->m_recent_line_start = 0;
+    this->m_directory.store(nullptr, std::memory_order_relaxed);
+    this->m_directory_count.store(0, std::memory_order_relaxed);
+    this->m_directory_capacity = 0;
+    this->m_published_size.store(0, std::memory_order_relaxed);
+    this->m_published_finished.store(false, std::memory_order_relaxed);
+    this->m_capture = Capture_Full;
+    this->m_limit = 0;
+    this->m_max_bytes = TAIL_MAX_BYTES;
+    this->m_segment = CHUNK_SIZE;
+}
+OutputBuffer::~OutputBuffer(){
+    this->clear();
+}
+void OutputBuffer::clear(){
+    for(Chunk& chunk : this->m_chunks){
+        delete[] chunk.data;
+        delete[] chunk.joined;
+    }
+    this->m_chunks.clear();
+    this->m_line_ends.clear();
+    this->m_line_base = 0;
+    this->m_line_start = 0;
+    this->m_line_offset = 0;
+    this->m_size = 0;
+    this->m_finished = false;
+    this->m_scan_ansi = 0;
+    this->m_pending_cr = false;
+    this->m_recent_begin = 0;
+    this->m_recent_size = 0;
+    this->m_recent_line = 0;
+    this->m_recent_line_start = 0;
+    // no reader may hold a snapshot past this point
+    delete[] this->m_directory.load(std::memory_order_relaxed);
+    for(Published* retired : this->m_retired){
+        delete[] retired;
+    }
+    this->m_retired.clear();
+    this->m_directory.store(nullptr, std::memory_order_relaxed);
+    this->m_directory_count.store(0, std::memory_order_relaxed);
+    this->m_directory_capacity = 0;
+    this->m_published_size.store(0, std::memory_order_relaxed);
+    this->m_published_finished.store(false, std::memory_order_relaxed);
+}
+void OutputBuffer::set_filter(unsigned filter){
+    this->m_filter = filter;
+}
+unsigned OutputBuffer::filter() const{
+    return this->m_filter;
+}
+void OutputBuffer::set_capture(Capture_ capture, size_t limit, size_t max_bytes){
+    this->m_capture = capture;
+    this->m_limit = limit;
+    this->m_max_bytes = max_bytes;
+    // a handful of segments per limit keeps the overshoot of the ring small
+    size_t budget = capture == Capture_TailBytes ? limit : max_bytes;
+    this->m_segment = std::clamp(budget / 4, OUTPUT_BUFFER_MIN_SEGMENT, CHUNK_SIZE);
+}
+Capture_ OutputBuffer::capture() const{
+    return this->m_capture;
+}
+bool OutputBuffer::recycle_oldest() const{
+    if(this->m_chunks.size() < 2){
+        return false;
+    }
+    const Chunk& next = this->m_chunks[1];
+    if(this->m_capture == Capture_TailBytes){
+        return this->m_size - next.text_begin >= this->m_limit;
+    }
+    return this->lines_seen() - next.first_line >= this->m_limit
+        || this->m_chunks.size() * this->m_segment >= this->m_max_bytes;
+}
+char* OutputBuffer::prepare(size_t& size){
+    if(this->m_capture == Capture_None && !this->m_chunks.empty()){
+        // nothing is retained: start over in the same chunk, keeping the
+        // unterminated line in front so recent_lines() sees it whole
+        Chunk& last = this->m_chunks.back();
+        size_t carry = last.size - this->m_line_start;
+        if(carry > last.capacity / 4){
+            carry = 0;
+            this->m_line_offset = this->m_size;
+        }
+        std::memmove(last.data, last.data + last.size - carry, carry);
+        this->m_line_base = this->lines_seen();
+        this->m_line_ends.clear();
+        last.prefix = carry;
+        last.size = carry;
+        last.first_line = this->m_line_base;
+        last.text_begin = this->m_size;
+        this->m_line_start = 0;
+    }
+    if(this->m_chunks.empty() || this->m_chunks.back().capacity - this->m_chunks.back().size < OUTPUT_BUFFER_MIN_FREE){
+        // Carry the unterminated line over so it stays contiguous
+        size_t carry = 0;
+        const char* carry_from = nullptr;
+        if(!this->m_chunks.empty()){
+            const Chunk& last = this->m_chunks.back();
+            carry = last.size - this->m_line_start;
+            carry_from = last.data + this->m_line_start;
+        }
+        char* data = nullptr;
+        size_t capacity;
+        if(this->m_capture == Capture_Full){
+            capacity = CHUNK_SIZE;
+            if(carry > capacity / 4){
+                // a long line is not copied into every chunk it reaches: it
+                // continues in place and join_line() copies it once it ends
+                carry = 0;
+            }
+        }else{
+            capacity = this->m_segment;
+            if(carry > capacity / 4){
+                // too long for the ring: only its tail is kept
+                carry = 0;
+                this->m_line_offset = this->m_size;
+            }
+            if(this->recycle_oldest()){
+                data = this->m_chunks.front().data;
+                this->m_chunks.erase(this->m_chunks.begin());
+                // drop the index entries of recycled lines once they make up
+                // half of the table
+                size_t dropped = this->m_chunks.front().first_line - this->m_line_base;
+                if(dropped > this->m_line_ends.size() / 2){
+                    this->m_line_ends.erase(this->m_line_ends.begin(), this->m_line_ends.begin() + dropped);
+                    this->m_line_base += dropped;
+                }
+            }
+        }
+        if(data == nullptr){
+            data = new char[capacity];
+        }
+        Chunk chunk;
+        chunk.data = data;
+        chunk.capacity = capacity;
+        chunk.prefix = carry;
+        chunk.size = carry;
+        chunk.first_line = this->lines_seen();
+        chunk.text_begin = this->m_size;
+        chunk.joined = nullptr;
+        chunk.joined_size = 0;
+        if(carry != 0){
+            std::memcpy(chunk.data, carry_from, carry);
+        }
+        this->m_chunks.push_back(chunk);
+        this->m_line_start = 0;
+        if(this->m_capture == Capture_Full){
+            this->publish_chunk(chunk);
+        }
+    }
+    Chunk& last = this->m_chunks.back();
+    if(this->m_pending_cr){
+        // keep the held back '\r' in front of the next read so the scanner
+        // sees it together with the byte that follows
+        last.data[last.size] = '\r';
+        size = last.capacity - last.size - 1;
+        return last.data + last.size + 1;
+    }
+    size = last.capacity - last.size;
+    return last.data + last.size;
+}
+void OutputBuffer::commit(size_t size){
+    Chunk& last = this->m_chunks.back();
+    size_t begin = last.size;
+    if(this->m_pending_cr){
+        size += 1;
+    }
+    ScanState state;
+    state.ansi = this->m_scan_ansi;
+    state.pending_cr = false;
+    size_t line_count = this->m_line_ends.size();
+    size_t kept = scan_lines(last.data + begin, size, this->m_filter, state, this->m_line_ends, (uint32_t)begin);
+    this->m_scan_ansi = state.ansi;
+    this->m_pending_cr = state.pending_cr;
+    last.size += kept;
+    this->m_size += kept;
+    this->m_recent_begin = begin;
+    this->m_recent_size = kept;
+    this->m_recent_line = line_count;
+    this->m_recent_line_start = this->m_line_start;
+    // the bytes (and any new chunk) are visible to snapshot() from here on
+    this->m_published_size.store(this->m_size, std::memory_order_release);
+    if(this->m_line_ends.size() != line_count){
+        if(this->m_line_offset + last.prefix < last.text_begin){
+            this->join_line(this->m_line_ends[line_count]);
+        }
+        this->m_line_start = this->m_line_ends.back() + 1;
+        this->m_line_offset = last.text_begin - last.prefix + this->m_line_start;
+    }
+}
+void OutputBuffer::join_line(size_t end){
+    // the head of the line is in the chunks before the last one, and each of
+    // them holds a piece of it in its text
+    Chunk& last = this->m_chunks.back();
+    size_t size = last.text_begin + end - this->m_line_offset;
+    char* joined = new char[size];
+    auto found = std::upper_bound(this->m_chunks.begin(), this->m_chunks.end(), this->m_line_offset,
+        [](size_t value, const Chunk& chunk){ return value < chunk.text_begin; });
+    size_t offset = this->m_line_offset;
+    for(auto chunk = found - 1; offset < this->m_line_offset + size; ++chunk){
+        size_t begin = chunk->prefix + offset - chunk->text_begin;
+        size_t count = std::min(chunk->size - begin, this->m_line_offset + size - offset);
+        std::memcpy(joined + (offset - this->m_line_offset), chunk->data + begin, count);
+        offset += count;
+    }
+    last.joined = joined;
+    last.joined_size = size;
+}
+void OutputBuffer::append(const char* data, size_t size){
+    while(size != 0){
+        size_t available;
+        char* target = this->prepare(available);
+        size_t count = std::min(available, size);
+        std::memcpy(target, data, count);
+        this->commit(count);
+        data += count;
+        size -= count;
+    }
+}
+void OutputBuffer::finish(){
+    this->m_recent_size = 0;
+    this->m_recent_line = this->m_line_ends.size();
+    if(this->m_finished || this->m_chunks.empty()){
+        return;
+    }
+    Chunk& last = this->m_chunks.back();
+    this->m_recent_begin = last.size;
+    this->m_recent_line_start = this->m_line_start;
+    if(this->m_pending_cr){
+        // a lone '\r' at the very end is kept as text
+        last.size += 1;
+        this->m_size += 1;
+        this->m_recent_size = 1;
+        this->m_pending_cr = false;
+        this->m_published_size.store(this->m_size, std::memory_order_release);
+    }
+    if(this->m_line_offset < this->m_size){
+        if(this->m_line_offset + last.prefix < last.text_begin){
+            this->join_line(last.size);
+        }
+        this->m_line_ends.push_back((uint32_t)last.size);
+        this->m_line_start = last.size;
+        this->m_line_offset = this->m_size;
+    }
+    this->m_finished = true;
+    this->m_published_finished.store(true, std::memory_order_release);
+}
+size_t OutputBuffer::chunk_of(size_t line) const{
+    // last chunk whose first line is <= line; chunks without a line end share
+    // first_line with their successor, which is where the line ends
+    auto found = std::upper_bound(this->m_chunks.begin(), this->m_chunks.end(), line,
+        [](size_t value, const Chunk& chunk){ return value < chunk.first_line; });
+    return (found - this->m_chunks.begin()) - 1;
+}
+size_t OutputBuffer::line_begin(size_t line, size_t chunk) const{
+    if(line == this->m_chunks[chunk].first_line){
+        return 0;
+    }
+    return this->m_line_ends[line - 1 - this->m_line_base] + 1;
+}
+std::string_view OutputBuffer::line_text(size_t line, size_t chunk) const{
+    const Chunk& found = this->m_chunks[chunk];
+    if(line == found.first_line && found.joined != nullptr){
+        return std::string_view(found.joined, found.joined_size);
+    }
+    size_t begin = this->line_begin(line, chunk);
+    return std::string_view(found.data + begin, this->m_line_ends[line - this->m_line_base] - begin);
+}
+size_t OutputBuffer::line_offset(size_t line) const{
+    if(line >= this->lines_seen()){
+        return this->m_line_offset;
+    }
+    size_t chunk = this->chunk_of(line);
+    const Chunk& found = this->m_chunks[chunk];
+    size_t end = this->m_line_ends[line - this->m_line_base];
+    return found.text_begin - found.prefix + end - this->line_text(line, chunk).size();
+}
+OutputBuffer::Window OutputBuffer::window() const{
+    Window window = {0, 0, 0, 0};
+    if(this->m_chunks.empty()){
+        return window;
+    }
+    const Chunk& front = this->m_chunks.front();
+    size_t lines = this->lines_seen();
+    if(this->m_capture == Capture_None){
+        window.line = lines;
+        window.chunk = this->m_chunks.size() - 1;
+        window.position = this->m_chunks.back().size;
+        window.offset = this->m_size;
+        return window;
+    }
+    if(this->m_capture == Capture_TailLines){
+        window.line = std::max(front.first_line, lines > this->m_limit ? lines - this->m_limit : 0);
+        window.chunk = this->m_chunks.size() - 1;
+        window.position = this->m_line_start;
+        if(window.line < lines){
+            window.chunk = this->chunk_of(window.line);
+            window.position = this->line_begin(window.line, window.chunk);
+        }
+        const Chunk& chunk = this->m_chunks[window.chunk];
+        window.offset = chunk.text_begin - chunk.prefix + window.position;
+        return window;
+    }
+    // the prefix of the oldest chunk is the only copy left of its bytes
+    window.offset = front.text_begin - front.prefix;
+    if(this->m_capture == Capture_TailBytes && this->m_size - window.offset > this->m_limit){
+        window.offset = this->m_size - this->m_limit;
+    }
+    auto found = std::upper_bound(this->m_chunks.begin() + 1, this->m_chunks.end(), window.offset,
+        [](size_t value, const Chunk& chunk){ return value < chunk.text_begin; });
+    window.chunk = (found - this->m_chunks.begin()) - 1;
+    const Chunk& chunk = this->m_chunks[window.chunk];
+    window.position = chunk.prefix + window.offset - chunk.text_begin;
+    // first line starting inside the window
+    size_t low = front.first_line;
+    size_t high = lines;
+    while(low < high){
+        size_t middle = low + (high - low) / 2;
+        if(this->line_offset(middle) < window.offset){
+            low = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
+    window.line = low;
+    return window;
+}
+size_t OutputBuffer::size() const{
+    return this->m_size - this->window().offset;
+}
+size_t OutputBuffer::line_count() const{
+    return this->lines_seen() - this->window().line;
+}
+size_t OutputBuffer::bytes_seen() const{
+    return this->m_size;
+}
+size_t OutputBuffer::lines_seen() const{
+    return this->m_line_base + this->m_line_ends.size();
+}
+size_t OutputBuffer::bytes_dropped() const{
+    return this->window().offset;
+}
+size_t OutputBuffer::lines_dropped() const{
+    return this->window().line;
+}
+std::string_view OutputBuffer::line(size_t index) const{
+    index += this->window().line;
+    if(index >= this->lines_seen()){
+        return std::string_view();
+    }
+    return TrimCR(this->line_text(index, this->chunk_of(index)));
+}
+std::vector<std::string_view> OutputBuffer::lines() const{
+    std::vector<std::string_view> lines;
+    size_t index = this->window().line;
+    size_t count = this->lines_seen();
+    if(index >= count){
+        return lines;
+    }
+    lines.reserve(count - index);
+    for(size_t c = this->chunk_of(index); c < this->m_chunks.size(); c++){
+        const Chunk& chunk = this->m_chunks[c];
+        size_t last = c + 1 < this->m_chunks.size() ? this->m_chunks[c + 1].first_line : count;
+        size_t begin = this->line_begin(index, c);
+        for(; index < last; index++){
+            size_t end = this->m_line_ends[index - this->m_line_base];
+            if(index == chunk.first_line && chunk.joined != nullptr){
+                lines.push_back(TrimCR(std::string_view(chunk.joined, chunk.joined_size)));
+            }else{
+                lines.push_back(TrimCR(std::string_view(chunk.data + begin, end - begin)));
+            }
+            begin = end + 1;
+        }
+    }
+    return lines;
+}
+std::vector<std::string_view> OutputBuffer::chunks() const{
+    std::vector<std::string_view> chunks;
+    if(this->m_chunks.empty()){
+        return chunks;
+    }
+    Window window = this->window();
+    chunks.reserve(this->m_chunks.size() - window.chunk);
+    for(size_t c = window.chunk; c < this->m_chunks.size(); c++){
+        const Chunk& chunk = this->m_chunks[c];
+        size_t begin = c == window.chunk ? window.position : chunk.prefix;
+        if(chunk.size > begin){
+            chunks.emplace_back(chunk.data + begin, chunk.size - begin);
+        }
+    }
+    return chunks;
+}
+std::string OutputBuffer::str() const{
+    std::string text;
+    text.reserve(this->size());
+    for(std::string_view chunk : this->chunks()){
+        text.append(chunk);
+    }
+    return text;
+}
+std::string_view OutputBuffer::recent() const{
+    if(this->m_chunks.empty()){
+        return std::string_view();
+    }
+    return std::string_view(this->m_chunks.back().data + this->m_recent_begin, this->m_recent_size);
+}
+void OutputBuffer::recent_lines(std::vector<std::string_view>& lines) const{
+    // Every line completed by the last commit ends in the last chunk, and
+    // the first one starts there too (carried over with the chunk prefix)
+    // unless it was long enough to be joined
+    if(this->m_chunks.empty()){
+        return;
+    }
+    const Chunk& last = this->m_chunks.back();
+    size_t begin = this->m_recent_line_start;
+    for(size_t index = this->m_recent_line; index < this->m_line_ends.size(); index++){
+        size_t end = this->m_line_ends[index];
+        if(this->m_line_base + index == last.first_line && last.joined != nullptr){
+            lines.push_back(TrimCR(std::string_view(last.joined, last.joined_size)));
+        }else{
+            lines.push_back(TrimCR(std::string_view(last.data + begin, end - begin)));
+        }
+        begin = end + 1;
+    }
+}
+void OutputBuffer::publish_chunk(const Chunk& chunk){
+    size_t count = this->m_directory_count.load(std::memory_order_relaxed);
+    Published* directory = this->m_directory.load(std::memory_order_relaxed);
+    if(count == this->m_directory_capacity){
+        // Readers may still walk the old directory: it is copied, not
+        // reallocated in place, and kept until clear()
+        size_t capacity = std::max((size_t)16, this->m_directory_capacity * 2);
+        Published* grown = new Published[capacity];
+        if(count != 0){
+            std::memcpy(grown, directory, count * sizeof(Published));
+            this->m_retired.push_back(directory);
+        }
+        directory = grown;
+        this->m_directory_capacity = capacity;
+        this->m_directory.store(directory, std::memory_order_release);
+    }
+    directory[count] = Published{chunk.data, chunk.prefix, chunk.text_begin};
+    this->m_directory_count.store(count + 1, std::memory_order_release);
+}
+OutputSnapshot OutputBuffer::snapshot() const{
+    if(this->m_capture != Capture_Full){
+        throw std::runtime_error("OutputBuffer::snapshot() needs Capture_Full");
+    }
+    // finished before size before count before directory: each load sees at
+    // least what the one before it implies
+    OutputSnapshot snapshot;
+    snapshot.m_finished = this->m_published_finished.load(std::memory_order_acquire);
+    snapshot.m_size = this->m_published_size.load(std::memory_order_acquire);
+    size_t count = this->m_directory_count.load(std::memory_order_acquire);
+    const Published* directory = this->m_directory.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; i++){
+        const Published& chunk = directory[i];
+        if(chunk.text_begin >= snapshot.m_size){
+            // published ahead of its text (or only holds a carried line)
+            break;
+        }
+        size_t end = i + 1 < count ? std::min(directory[i + 1].text_begin, snapshot.m_size) : snapshot.m_size;
+        snapshot.m_chunks.emplace_back(chunk.data + chunk.prefix, end - chunk.text_begin);
+        snapshot.m_prefixes.push_back(chunk.prefix);
+        snapshot.m_offsets.push_back(chunk.text_begin);
+    }
+    return snapshot;
+}
+OutputSnapshot::OutputSnapshot(){
+    this->m_size = 0;
+    this->m_finished = false;
+}
+size_t OutputSnapshot::size() const{
+    return this->m_size;
+}
+const std::vector<std::string_view>& OutputSnapshot::chunks() const{
+    return this->m_chunks;
+}
+bool OutputSnapshot::finished() const{
+    return this->m_finished;
+}
+std::string OutputSnapshot::str() const{
+    std::string text;
+    text.reserve(this->m_size);
+    for(std::string_view chunk : this->m_chunks){
+        text.append(chunk);
+    }
+    return text;
+}
+std::vector<std::string_view> OutputSnapshot::lines() const{
+    // A short line continued in the next chunk is copied in front of its
+    // text, so each chunk's lines are found from the start of that prefix and
+    // the unterminated tail of all but the last chunk is left to the next
+    // one. A long line is continued in place: its pieces are joined.
+    std::vector<std::string_view> lines;
+    size_t head = 0;
+    for(size_t c = 0; c < this->m_chunks.size(); c++){
+        std::string_view text = this->m_chunks[c];
+        size_t offset = this->m_offsets[c];
+        bool spans = head + this->m_prefixes[c] < offset;
+        const char* begin = text.data() - this->m_prefixes[c];
+        const char* end = text.data() + text.size();
+        while(begin < end){
+            const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+            if(newline == nullptr){
+                if(c + 1 == this->m_chunks.size() && this->m_finished){
+                    lines.push_back(TrimCR(spans ? this->join(head, this->m_size) : std::string_view(begin, end - begin)));
+                }
+                break;
+            }
+            lines.push_back(TrimCR(spans ? this->join(head, offset + (newline - text.data())) : std::string_view(begin, newline - begin)));
+            spans = false;
+            begin = newline + 1;
+            head = offset + (begin - text.data());
+        }
+    }
+    return lines;
+}
+std::string_view OutputSnapshot::partial() const{
+    if(this->m_chunks.empty() || this->m_finished){
+        return std::string_view();
+    }
+    // the unterminated line starts after the last newline, in front of the
+    // first chunk that carried it, or at the very beginning
+    size_t begin = 0;
+    for(size_t c = this->m_chunks.size(); c-- > 0;){
+        size_t newline = this->m_chunks[c].rfind('\n');
+        if(newline != std::string_view::npos){
+            begin = this->m_offsets[c] + newline + 1;
+            break;
+        }
+        if(this->m_prefixes[c] != 0){
+            begin = this->m_offsets[c] - this->m_prefixes[c];
+            break;
+        }
+    }
+    return this->join(begin, this->m_size);
+}
+std::string_view OutputSnapshot::join(size_t begin, size_t end) const{
+    // text inside one chunk, or a carried line with its prefix, is viewed in
+    // place; anything else is copied together once per snapshot
+    auto found = std::upper_bound(this->m_offsets.begin(), this->m_offsets.end(), begin);
+    size_t c = (found - this->m_offsets.begin()) - 1;
+    if(c + 1 < this->m_offsets.size() && this->m_offsets[c + 1] - this->m_prefixes[c + 1] <= begin){
+        c++;
+    }
+    if(end <= this->m_offsets[c] + this->m_chunks[c].size()){
+        return std::string_view(this->m_chunks[c].data() - this->m_offsets[c] + begin, end - begin);
+    }
+    std::string& joined = this->m_joined[begin];
+    if(joined.empty()){
+        joined.reserve(end - begin);
+        for(; joined.size() < end - begin; c++){
+            joined.append(this->m_chunks[c].substr(begin + joined.size() - this->m_offsets[c], end - begin - joined.size()));
+        }
+    }
+    return joined;
+}
@@ -0,0 +1,210 @@
+#ifndef _WIN32
+#include "reactor.h"
+#include <cerrno>
+#include <condition_variable>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+using namespace subprocess_manager;
+
+// Tick used while periodic checks are pending
+static const int REACTOR_POLL_MS = 10;
+// Wake token; handler tokens start at 1
+static const uint64_t REACTOR_WAKE_TOKEN = 0;
+
+Reactor& Reactor::instance(){
+    static Reactor reactor;
+    return reactor;
+}
+Reactor::Reactor(){
+    this->m_stop = false;
+    this->m_next_token = 1;
+    this->m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(this->m_epoll_fd == -1){
+        throw std::runtime_error("Unable to create epoll instance");
+    }
+    this->m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(this->m_wake_fd == -1){
+        close(this->m_epoll_fd);
+        throw std::runtime_error("Unable to create reactor wake fd");
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = REACTOR_WAKE_TOKEN;
+    epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, this->m_wake_fd, &event);
+    this->m_thread = std::thread(&Reactor::run, this);
+}
+Reactor::~Reactor(){
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_stop = true;
+    }
+    this->wake();
+    if(this->m_thread.joinable()){
+        this->m_thread.join();
+    }
+    close(this->m_wake_fd);
+    close(this->m_epoll_fd);
+}
+uint64_t Reactor::add(int fd, uint32_t events, Handler handler){
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    uint64_t token = this->m_next_token++;
+    this->m_entries[token] = Entry{fd, std::make_shared<Handler>(std::move(handler))};
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.u64 = token;
+    if(epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0){
+        this->m_entries.erase(token);
+        throw std::runtime_error("Unable to watch child process descriptor");
+    }
+    return token;
+}
+void Reactor::modify(uint64_t token, uint32_t events){
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    auto found = this->m_entries.find(token);
+    if(found == this->m_entries.end()){
+        return;
+    }
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.u64 = token;
+    epoll_ctl(this->m_epoll_fd, EPOLL_CTL_MOD, found->second.fd, &event);
+}
+void Reactor::remove(uint64_t token){
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    auto found = this->m_entries.find(token);
+    if(found == this->m_entries.end()){
+        return;
+    }
+    epoll_ctl(this->m_epoll_fd, EPOLL_CTL_DEL, found->second.fd, nullptr);
+    this->m_entries.erase(found);
+}
+void Reactor::post(std::function<void()> task){
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_posted.push_back(std::move(task));
+    }
+    this->wake();
+}
+void Reactor::call(std::function<void()> task){
+    if(this->in_loop_thread()){
+        task();
+        return;
+    }
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+    this->post([&](){
+        task();
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        done_cv.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&done](){ return done; });
+}
+void Reactor::poll(std::function<bool()> check){
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_polls.push_back(std::move(check));
+    }
+    this->wake();
+}
+uint64_t Reactor::add_timer(std::chrono::steady_clock::time_point when, std::function<void()> callback){
+    uint64_t token;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        token = this->m_timers.add(when, std::move(callback));
+    }
+    // the loop may be sleeping past the new deadline
+    if(!this->in_loop_thread()){
+        this->wake();
+    }
+    return token;
+}
+void Reactor::cancel_timer(uint64_t token){
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    this->m_timers.cancel(token);
+}
+bool Reactor::in_loop_thread() const{
+    return std::this_thread::get_id() == this->m_thread.get_id();
+}
+void Reactor::wake(){
+    uint64_t one = 1;
+    ssize_t ignored = write(this->m_wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+void Reactor::run(){
+    struct epoll_event events[256];
+    while(true){
+        int timeout = -1;
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            if(this->m_stop){
+                break;
+            }
+            if(!this->m_polls.empty()){
+                timeout = REACTOR_POLL_MS;
+            }
+            int next = this->m_timers.next_timeout_ms(TimerWheel::Clock::now());
+            if(next != -1 && (timeout == -1 || next < timeout)){
+                timeout = next;
+            }
+        }
+        int count = epoll_wait(this->m_epoll_fd, events, 256, timeout);
+        if(count == -1 && errno != EINTR){
+            break;
+        }
+        for(int i = 0; i < count; i++){
+            if(events[i].data.u64 == REACTOR_WAKE_TOKEN){
+                uint64_t value;
+                ssize_t ignored = read(this->m_wake_fd, &value, sizeof(value));
+                (void)ignored;
+                continue;
+            }
+            // Look the handler up per event: an earlier handler in this batch
+            // may have removed it.
+            std::shared_ptr<Handler> handler;
+            {
+                std::lock_guard<std::mutex> lock(this->m_mutex);
+                auto found = this->m_entries.find(events[i].data.u64);
+                if(found == this->m_entries.end()){
+                    continue;
+                }
+                handler = found->second.handler;
+            }
+            (*handler)(events[i].events);
+        }
+        std::vector<std::function<void()>> posted;
+        std::vector<std::function<bool()>> polls;
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            posted.swap(this->m_posted);
+            polls.swap(this->m_polls);
+        }
+        for(auto& task : posted){
+            task();
+        }
+        // Collected after the handlers and tasks, which may cancel timers
+        std::vector<std::pair<uint64_t,TimerWheel::Callback>> expired;
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_timers.advance(TimerWheel::Clock::now(), expired);
+        }
+        for(auto& timer : expired){
+            timer.second();
+        }
+        std::vector<std::function<bool()>> pending;
+        for(auto& check : polls){
+            if(!check()){
+                pending.push_back(std::move(check));
+            }
+        }
+        if(!pending.empty()){
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_polls.insert(this->m_polls.end(), pending.begin(), pending.end());
+        }
+    }
+}
+#endif // _WIN32
@@ -0,0 +1,53 @@
+#ifndef REACTOR_H                  // Include guard to prevent multiple definitions
+#define REACTOR_H
+#ifndef _WIN32
+#include <cstdint>              // For fixed width integers
+#include <functional>           // For event handlers
+#include <memory>               // For shared handler ownership
+#include <mutex>                // For guarding the handler table
+#include <thread>               // For the event loop thread
+#include <unordered_map>        // For the handler table
+#include <vector>               // For posted tasks and poll callbacks
+#include "timer_wheel.h"        // For timers
+namespace subprocess_manager {
+    // Single epoll based event loop shared by every Subprocess in the process.
+    // Child pipes and pidfds are registered here instead of dedicating a
+    // monitor thread to each child. Handlers always run on the loop thread.
+    // Timers (timeouts, kill grace periods) live in one timing wheel that
+    // sets the epoll_wait timeout, so they cost no thread either.
+    class Reactor {
+        public:
+            using Handler = std::function<void(uint32_t events)>;
+            static Reactor&                             instance();         // Lazily started process wide reactor
+            uint64_t                                    add(int fd, uint32_t events, Handler handler); // Watch fd, returns a token
+            void                                        modify(uint64_t token, uint32_t events); // Change the watched events
+            void                                        remove(uint64_t token); // Stop watching (fd is not closed)
+            void                                        post(std::function<void()> task); // Run task on the loop thread
+            void                                        call(std::function<void()> task); // Run task on the loop thread and wait for it (inline there)
+            void                                        poll(std::function<bool()> check); // Run check every tick until it returns true
+            uint64_t                                    add_timer(std::chrono::steady_clock::time_point when, std::function<void()> callback); // Run callback on the loop thread at when, returns a token
+            void                                        cancel_timer(uint64_t token); // Drop a pending timer (no-op once it ran)
+            bool                                        in_loop_thread() const; // True when called from a handler
+        private:
+            struct Entry {
+                int                                     fd;                 // Watched descriptor
+                std::shared_ptr<Handler>                handler;            // Callback for events on fd
+            };
+            int                                         m_epoll_fd;         // epoll instance
+            int                                         m_wake_fd;          // eventfd used to wake the loop
+            bool                                        m_stop;             // Set by the destructor
+            uint64_t                                    m_next_token;       // Next handler token
+            std::mutex                                  m_mutex;            // Guards the tables below
+            std::unordered_map<uint64_t,Entry>          m_entries;          // Registered handlers by token
+            std::vector<std::function<void()>>          m_posted;           // Tasks waiting to run on the loop
+            std::vector<std::function<bool()>>          m_polls;            // Periodic checks (pidfd fallback)
+            TimerWheel                                  m_timers;           // Pending timers
+            std::thread                                 m_thread;           // Event loop thread
+            void                                        run();              // Event loop
+            void                                        wake();             // Interrupt epoll_wait
+            Reactor();                                                      // Constructor
+            ~Reactor();                                                     // Destructor
+    };
+}
+#endif // _WIN32
+#endif // REACTOR_H
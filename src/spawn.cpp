@@ -0,0 +1,160 @@
+#ifndef _WIN32
+#include "spawn.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+using namespace subprocess_manager;
+
+// ThreadSanitizer keeps its state in the address space a CLONE_VM child
+// would share, so sanitized builds take the fork() path
+#if defined(__linux__) && !defined(__SANITIZE_THREAD__)
+#define SPAWN_CLONE_VM
+#endif
+// Stack of the cloned child; it only runs spawn_child
+static const size_t SPAWN_STACK_SIZE = 64 * 1024;
+
+std::string subprocess_manager::find_executable(const std::string& name){
+    if(name.find('/') != std::string::npos){
+        return name;
+    }
+    const char* path = getenv("PATH");
+    std::string dirs = path != nullptr ? path : "/bin:/usr/bin";
+    size_t begin = 0;
+    while(begin <= dirs.size()){
+        size_t end = dirs.find(':', begin);
+        if(end == std::string::npos){
+            end = dirs.size();
+        }
+        // an empty entry is the current directory
+        std::string dir = end == begin ? "." : dirs.substr(begin, end - begin);
+        std::string candidate = dir + "/" + name;
+        struct stat info;
+        if(stat(candidate.c_str(), &info) == 0 && S_ISREG(info.st_mode) && access(candidate.c_str(), X_OK) == 0){
+            return candidate;
+        }
+        begin = end + 1;
+    }
+    return "";
+}
+// Report why the child could not exec and leave
+[[noreturn]] static void spawn_fail(SpawnRequest& request){
+    request.error = errno;
+    if(request.report_fd != -1){
+        ssize_t ignored = write(request.report_fd, &request.error, sizeof(request.error));
+        (void)ignored;
+    }
+    _exit(127);
+}
+// Runs in the child, sharing the parent's memory on Linux: only async
+// signal safe calls, no allocation, the outcome goes to request.error.
+static int spawn_child(void* arg){
+    SpawnRequest& request = *static_cast<SpawnRequest*>(arg);
+    // Parent handlers must not run here; ignored signals stay ignored
+    for(int sig = 1; sig < NSIG; sig++){
+        struct sigaction action;
+        if(sigaction(sig, nullptr, &action) == 0 && action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL){
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = SIG_DFL;
+            sigaction(sig, &action, nullptr);
+        }
+    }
+    for(int i = 0; i < 3; i++){
+        if(request.fds[i] == i){
+            // a descriptor already in place only has to survive the exec
+            fcntl(i, F_SETFD, 0);
+        }else if(request.fds[i] != -1 && dup2(request.fds[i], i) == -1){
+            spawn_fail(request);
+        }
+    }
+    if(request.curr_dir != nullptr && chdir(request.curr_dir) != 0){
+        spawn_fail(request);
+    }
+    // done before exec, so the group exists once spawn_process() returns
+    if(request.new_group && setpgid(0, 0) != 0){
+        spawn_fail(request);
+    }
+#ifdef __linux__
+    if(request.affinity != nullptr && sched_setaffinity(0, sizeof(cpu_set_t), request.affinity) != 0){
+        spawn_fail(request);
+    }
+#endif
+    pthread_sigmask(SIG_SETMASK, &request.mask, nullptr);
+    // Limits go last: a small address space must not fail the steps above
+    for(int i = 0; i < request.limit_count; i++){
+        // only root may raise a hard limit
+        struct rlimit value = request.limits[i].value;
+        struct rlimit current;
+        if(getrlimit(request.limits[i].resource, &current) == 0 && current.rlim_max != RLIM_INFINITY){
+            if(value.rlim_max == RLIM_INFINITY || value.rlim_max > current.rlim_max){
+                value.rlim_max = current.rlim_max;
+            }
+            if(value.rlim_cur == RLIM_INFINITY || value.rlim_cur > value.rlim_max){
+                value.rlim_cur = value.rlim_max;
+            }
+        }
+        if(setrlimit(request.limits[i].resource, &value) != 0){
+            spawn_fail(request);
+        }
+    }
+    execve(request.path, request.argv, request.envp);
+    spawn_fail(request);
+}
+pid_t subprocess_manager::spawn_process(SpawnRequest& request){
+    request.error = 0;
+    request.report_fd = -1;
+    // Signals stay blocked until the child has reset its handlers
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &request.mask);
+#ifdef SPAWN_CLONE_VM
+    std::unique_ptr<char[]> stack(new char[SPAWN_STACK_SIZE]);
+    // CLONE_VFORK suspends this thread until the child exec()s or exits
+    pid_t pid = clone(spawn_child, stack.get() + SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &request);
+    int error = pid == -1 ? errno : request.error;
+#else
+    // The child reports a failed exec through a close-on-exec pipe
+    int err_pipe[2];
+    if(pipe(err_pipe) != 0){
+        int error = errno;
+        pthread_sigmask(SIG_SETMASK, &request.mask, nullptr);
+        errno = error;
+        return -1;
+    }
+    fcntl(err_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(err_pipe[1], F_SETFD, FD_CLOEXEC);
+    pid_t pid = fork();
+    if(pid == 0){
+        close(err_pipe[0]);
+        request.report_fd = err_pipe[1];
+        spawn_child(&request);
+    }
+    int error = pid == -1 ? errno : 0;
+    close(err_pipe[1]);
+    if(pid != -1){
+        ssize_t count;
+        do {
+            count = read(err_pipe[0], &request.error, sizeof(request.error));
+        } while(count == -1 && errno == EINTR);
+        error = count == sizeof(request.error) ? request.error : 0;
+    }
+    close(err_pipe[0]);
+#endif
+    pthread_sigmask(SIG_SETMASK, &request.mask, nullptr);
+    if(pid != -1 && error != 0){
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+    errno = error;
+    return pid;
+}
+#endif // _WIN32
@@ -0,0 +1,46 @@
+#ifndef SPAWN_H                    // Include guard to prevent multiple definitions
+#define SPAWN_H
+#ifndef _WIN32
+#include <signal.h>             // For sigset_t
+#include <string>               // For executable lookup
+#include <sys/types.h>          // For pid_t
+#include <sys/resource.h>       // For struct rlimit
+#ifdef __linux__
+#include <sched.h>              // For cpu_set_t
+#endif
+namespace subprocess_manager {
+    // Most limits one request carries
+    static const int SPAWN_MAX_LIMITS = 4;
+    // One setrlimit() call of the child
+    struct SpawnLimit {
+        int                                             resource;           // RLIMIT_*
+        struct rlimit                                   value;              // Soft and hard limit (clamped to the inherited hard limit)
+    };
+    // Everything the child needs between clone and exec, prepared by the
+    // parent so the child never allocates or touches shared state.
+    struct SpawnRequest {
+        const char*                                     path;               // Resolved executable (see find_executable)
+        char* const*                                    argv;               // Null terminated arguments
+        char* const*                                    envp;               // Null terminated environment
+        const char*                                     curr_dir;           // Working directory, nullptr to inherit
+        int                                             fds[3];             // dup2() onto 0, 1, 2 (-1 keeps the parent's)
+        sigset_t                                        mask;               // Signal mask restored before exec
+        bool                                            new_group;          // setpgid(0, 0): lead a new process group
+#ifdef __linux__
+        const cpu_set_t*                                affinity;           // sched_setaffinity() before exec, nullptr to inherit
+#endif
+        const SpawnLimit*                               limits;             // setrlimit() before exec
+        int                                             limit_count;        // Entries in limits (at most SPAWN_MAX_LIMITS)
+        int                                             error;              // errno of the failed step, 0 on success
+        int                                             report_fd;          // Without CLONE_VM: pipe error is written to
+    };
+    std::string                                         find_executable(const std::string& name); // PATH lookup as execvp does it, "" if not found
+    // Start a child and return once it has exec()ed. On Linux the child is
+    // created with clone(CLONE_VM | CLONE_VFORK): it borrows the parent's
+    // address space instead of copying its page tables, so the cost does not
+    // grow with the parent's memory. Returns -1 with errno set when the
+    // child could not be created or could not exec (it is reaped then).
+    pid_t                                               spawn_process(SpawnRequest& request);
+}
+#endif // _WIN32
+#endif // SPAWN_H
@@ -0,0 +1,365 @@
+#ifndef _WIN32
+#include "spawn_server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "reactor.h"
+using namespace subprocess_manager;
+
+// Fixed part of a spawn request, followed by the CPU set (if has_affinity),
+// limit_count SpawnLimits and the null terminated strings: path, working
+// directory (if has_dir), argc arguments, envc variables
+struct RequestHeader {
+    uint32_t                                            argc;               // Number of arguments
+    uint32_t                                            envc;               // Number of environment variables
+    uint8_t                                             has_dir;            // Working directory present
+    uint8_t                                             has_affinity;       // cpu_set_t present
+    uint8_t                                             fds;                // Bit i: a descriptor for fd i is attached
+    uint8_t                                             limit_count;        // Number of SpawnLimits
+    uint8_t                                             new_group;          // Lead a new process group
+};
+struct SpawnReply {
+    int32_t                                             pid;                // Child, -1 on failure
+    int32_t                                             error;              // errno of the failure
+};
+
+static bool SendMessage(int fd, const void* data, size_t size, const int* fds, int count, int flags = 0){
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)];
+    if(count > 0){
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+    }
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL | flags);
+    } while(sent == -1 && errno == EINTR);
+    return sent == (ssize_t)size;
+}
+// Helper side: reap every exited child and report as many as the socket
+// takes. The rest waits in backlog: blocking here could deadlock with a
+// parent that is itself waiting for a spawn reply before it reads events.
+static void ReportExits(int event_fd, std::deque<ExitEvent>& backlog){
+    while(true){
+        int status = 0;
+        struct rusage usage = {};
+        pid_t pid = wait4(-1, &status, WNOHANG, &usage);
+        if(pid == -1 && errno == EINTR){
+            continue;
+        }
+        if(pid <= 0){
+            break;
+        }
+        backlog.push_back(ExitEvent{pid, status, usage});
+    }
+    while(!backlog.empty() && SendMessage(event_fd, &backlog.front(), sizeof(ExitEvent), nullptr, 0, MSG_DONTWAIT)){
+        backlog.pop_front();
+    }
+}
+// Helper side: receive one request, spawn it and reply. False once the
+// parent has closed its end.
+static bool ServeRequest(int request_fd, const sigset_t& mask){
+    ssize_t size;
+    do {
+        size = recv(request_fd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+    } while(size == -1 && errno == EINTR);
+    if(size <= 0){
+        return false;
+    }
+    std::vector<char> buffer((size_t)size + 1);
+    struct iovec iov;
+    iov.iov_base = buffer.data();
+    iov.iov_len = (size_t)size;
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)];
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t count;
+    do {
+        // received descriptors must not leak into the next children
+        count = recvmsg(request_fd, &message, MSG_CMSG_CLOEXEC);
+    } while(count == -1 && errno == EINTR);
+    if(count <= 0){
+        return false;
+    }
+    int received[3] = {-1, -1, -1};
+    int received_count = 0;
+    for(struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)){
+        if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS){
+            received_count = (int)((header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(received, CMSG_DATA(header), sizeof(int) * received_count);
+        }
+    }
+    // Unpack the strings in place
+    RequestHeader request_header;
+    memcpy(&request_header, buffer.data(), sizeof(request_header));
+    char* cursor = buffer.data() + sizeof(request_header);
+    cpu_set_t affinity;
+    SpawnRequest request;
+    request.affinity = nullptr;
+    if(request_header.has_affinity){
+        memcpy(&affinity, cursor, sizeof(affinity));
+        request.affinity = &affinity;
+        cursor += sizeof(affinity);
+    }
+    request.new_group = request_header.new_group != 0;
+    SpawnLimit limits[SPAWN_MAX_LIMITS];
+    request.limit_count = std::min((int)request_header.limit_count, SPAWN_MAX_LIMITS);
+    request.limits = limits;
+    memcpy(limits, cursor, sizeof(SpawnLimit) * request.limit_count);
+    cursor += sizeof(SpawnLimit) * request_header.limit_count;
+    auto next = [&cursor](){
+        char* text = cursor;
+        cursor += strlen(cursor) + 1;
+        return text;
+    };
+    request.path = next();
+    request.curr_dir = request_header.has_dir ? next() : nullptr;
+    std::vector<char*> strings;
+    for(uint32_t i = 0; i < request_header.argc; i++){
+        strings.push_back(next());
+    }
+    strings.push_back(nullptr);
+    for(uint32_t i = 0; i < request_header.envc; i++){
+        strings.push_back(next());
+    }
+    strings.push_back(nullptr);
+    request.argv = strings.data();
+    request.envp = strings.data() + request_header.argc + 1;
+    for(int i = 0, used = 0; i < 3; i++){
+        request.fds[i] = (request_header.fds & (1 << i)) && used < received_count ? received[used++] : -1;
+    }
+    // Children start with the mask the parent had, not with SIGCHLD blocked
+    sigset_t blocked;
+    pthread_sigmask(SIG_SETMASK, &mask, &blocked);
+    SpawnReply reply;
+    reply.pid = spawn_process(request);
+    reply.error = reply.pid == -1 ? errno : 0;
+    pthread_sigmask(SIG_SETMASK, &blocked, nullptr);
+    for(int i = 0; i < received_count; i++){
+        close(received[i]);
+    }
+    SendMessage(request_fd, &reply, sizeof(reply), nullptr, 0);
+    return true;
+}
+// Helper process main loop
+[[noreturn]] static void Serve(int request_fd, int event_fd, const sigset_t& mask){
+    // Exits are picked up through a signalfd, so SIGCHLD stays blocked
+    // except while a child is being spawned
+    sigset_t child_mask;
+    sigemptyset(&child_mask);
+    sigaddset(&child_mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &child_mask, nullptr);
+    int signal_fd = signalfd(-1, &child_mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    std::deque<ExitEvent> backlog;
+    struct pollfd fds[3] = {{request_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}, {event_fd, POLLOUT, 0}};
+    while(true){
+        // only wait for room on the event socket while events are held back
+        if(poll(fds, backlog.empty() ? 2 : 3, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        if(fds[1].revents != 0){
+            struct signalfd_siginfo info;
+            while(read(signal_fd, &info, sizeof(info)) > 0);
+        }
+        if(fds[0].revents != 0 && !ServeRequest(request_fd, mask)){
+            break;
+        }
+        // also catches a SIGCHLD discarded while the mask was lifted
+        ReportExits(event_fd, backlog);
+    }
+    // Never return into the parent's copy of the program
+    _exit(0);
+}
+// Helper side: drop every descriptor inherited from the parent except the
+// standard streams and the two sockets
+static void CloseInherited(int first, int second){
+    int keep[2] = {first < second ? first : second, first < second ? second : first};
+    unsigned begin = 3;
+    for(int fd : keep){
+        for(unsigned other = begin; other < (unsigned)fd; other++){
+            close((int)other);
+        }
+        begin = (unsigned)fd + 1;
+    }
+#ifdef SYS_close_range
+    if(syscall(SYS_close_range, begin, ~0U, 0) == 0){
+        return;
+    }
+#endif
+    long limit = sysconf(_SC_OPEN_MAX);
+    for(long fd = begin; fd < (limit > 0 && limit < 65536 ? limit : 65536); fd++){
+        close((int)fd);
+    }
+}
+
+static std::mutex s_spawn_server_mutex;
+static SpawnServer* s_spawn_server = nullptr;
+
+void SpawnServer::start(){
+    std::lock_guard<std::mutex> lock(s_spawn_server_mutex);
+    if(s_spawn_server == nullptr){
+        // Lives until the process exits; the helper leaves when its socket closes
+        s_spawn_server = new SpawnServer();
+    }
+}
+SpawnServer* SpawnServer::instance(){
+    std::lock_guard<std::mutex> lock(s_spawn_server_mutex);
+    return s_spawn_server;
+}
+SpawnServer::SpawnServer(){
+    this->m_lost = false;
+    int request_pair[2];
+    int event_pair[2];
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, request_pair) != 0){
+        throw std::runtime_error("Unable to create spawn server socket");
+    }
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, event_pair) != 0){
+        close(request_pair[0]);
+        close(request_pair[1]);
+        throw std::runtime_error("Unable to create spawn server socket");
+    }
+    sigset_t mask;
+    pthread_sigmask(SIG_SETMASK, nullptr, &mask);
+    this->m_pid = fork();
+    if(this->m_pid == 0){
+        CloseInherited(request_pair[1], event_pair[1]);
+        Serve(request_pair[1], event_pair[1], mask);
+    }
+    close(request_pair[1]);
+    close(event_pair[1]);
+    if(this->m_pid == -1){
+        close(request_pair[0]);
+        close(event_pair[0]);
+        throw std::runtime_error("Unable to start spawn server");
+    }
+    this->m_request_fd = request_pair[0];
+    this->m_event_fd = event_pair[0];
+    fcntl(this->m_event_fd, F_SETFL, fcntl(this->m_event_fd, F_GETFL) | O_NONBLOCK);
+    this->m_event_token = Reactor::instance().add(this->m_event_fd, EPOLLIN, [this](uint32_t){ this->on_event(); });
+}
+pid_t SpawnServer::spawn(SpawnRequest& request){
+    RequestHeader header = {};
+    std::string message(sizeof(header), '\0');
+    auto append = [&message](const char* text){
+        message.append(text, strlen(text) + 1);
+    };
+    if(request.affinity != nullptr){
+        header.has_affinity = 1;
+        message.append(reinterpret_cast<const char*>(request.affinity), sizeof(cpu_set_t));
+    }
+    header.new_group = request.new_group ? 1 : 0;
+    header.limit_count = (uint8_t)request.limit_count;
+    message.append(reinterpret_cast<const char*>(request.limits), sizeof(SpawnLimit) * request.limit_count);
+    append(request.path);
+    if(request.curr_dir != nullptr){
+        header.has_dir = 1;
+        append(request.curr_dir);
+    }
+    for(char* const* arg = request.argv; *arg != nullptr; arg++, header.argc++){
+        append(*arg);
+    }
+    for(char* const* var = request.envp; *var != nullptr; var++, header.envc++){
+        append(*var);
+    }
+    int fds[3];
+    int count = 0;
+    for(int i = 0; i < 3; i++){
+        if(request.fds[i] != -1){
+            header.fds |= (uint8_t)(1 << i);
+            fds[count++] = request.fds[i];
+        }
+    }
+    memcpy(&message[0], &header, sizeof(header));
+
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    if(!SendMessage(this->m_request_fd, message.data(), message.size(), fds, count)){
+        // EMSGSIZE: larger than the socket buffer; EPIPE: the helper is gone
+        return -1;
+    }
+    SpawnReply reply;
+    ssize_t received;
+    do {
+        received = recv(this->m_request_fd, &reply, sizeof(reply), 0);
+    } while(received == -1 && errno == EINTR);
+    if(received != sizeof(reply)){
+        errno = EPIPE;
+        return -1;
+    }
+    errno = reply.error;
+    return reply.pid;
+}
+void SpawnServer::watch(pid_t pid, ExitCallback on_exit){
+    auto found = this->m_exited.find(pid);
+    if(found != this->m_exited.end()){
+        ExitEvent event = found->second;
+        this->m_exited.erase(found);
+        on_exit(event.status, &event.usage);
+    }else if(this->m_lost){
+        on_exit(SPAWN_STATUS_LOST, nullptr);
+    }else{
+        this->m_watchers[pid] = std::move(on_exit);
+    }
+}
+void SpawnServer::on_event(){
+    while(true){
+        ExitEvent event;
+        ssize_t count = recv(this->m_event_fd, &event, sizeof(event), 0);
+        if(count == -1 && errno == EINTR){
+            continue;
+        }
+        if(count == -1 && errno == EAGAIN){
+            return;
+        }
+        if(count != sizeof(event)){
+            break;
+        }
+        auto found = this->m_watchers.find(event.pid);
+        if(found == this->m_watchers.end()){
+            // the spawning thread has not called watch() yet
+            this->m_exited[event.pid] = event;
+            continue;
+        }
+        ExitCallback on_exit = std::move(found->second);
+        this->m_watchers.erase(found);
+        on_exit(event.status, &event.usage);
+    }
+    // The helper is gone: nobody will report the remaining children
+    Reactor::instance().remove(this->m_event_token);
+    this->m_lost = true;
+    std::unordered_map<pid_t,ExitCallback> watchers;
+    watchers.swap(this->m_watchers);
+    for(auto& watcher : watchers){
+        watcher.second(SPAWN_STATUS_LOST, nullptr);
+    }
+}
+#endif // _WIN32
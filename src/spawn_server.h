@@ -0,0 +1,50 @@
+#ifndef SPAWN_SERVER_H             // Include guard to prevent multiple definitions
+#define SPAWN_SERVER_H
+#ifndef _WIN32
+#include <cstdint>              // For fixed width integers
+#include <functional>           // For exit callbacks
+#include <mutex>                // For serialising requests
+#include <unordered_map>        // For exit bookkeeping
+#include <sys/types.h>          // For pid_t
+#include <sys/resource.h>       // For struct rusage
+#include "spawn.h"              // For SpawnRequest
+namespace subprocess_manager {
+    // Status passed to watchers when the helper died before reporting the child
+    static const int SPAWN_STATUS_LOST = -1;
+    // Exit report of a child, sent by the helper
+    struct ExitEvent {
+        int32_t                                         pid;                // Reaped child
+        int32_t                                         status;             // Its wait status
+        struct rusage                                   usage;              // Its resource usage, from wait4()
+    };
+    // Helper process that spawns children on behalf of this one.
+    //
+    // It is forked once, early, while the parent is still small, and then
+    // serves spawn requests sent over a Unix socket: argv, envp and working
+    // directory travel in the message, the standard stream descriptors as
+    // SCM_RIGHTS. The helper starts the child with spawn_process(), replies
+    // with its pid, reaps it and reports the wait status and rusage on a second socket
+    // that the reactor watches. A spawn then costs the same however large
+    // the parent's heap, thread count or descriptor table has grown.
+    class SpawnServer {
+        public:
+            static void                                 start();            // Fork the helper; later spawns go through it
+            static SpawnServer*                         instance();         // Running helper, nullptr if not started
+            pid_t                                       spawn(SpawnRequest& request); // As spawn_process(), the child belongs to the helper
+            using ExitCallback = std::function<void(int status, const struct rusage* usage)>; // usage is nullptr with SPAWN_STATUS_LOST
+            void                                        watch(pid_t pid, ExitCallback on_exit); // Call on_exit with the wait status (loop thread only)
+        private:
+            int                                         m_request_fd;       // Requests out, pid replies in
+            int                                         m_event_fd;         // Exit statuses in (non-blocking, on the reactor)
+            pid_t                                       m_pid;              // Helper process
+            uint64_t                                    m_event_token;      // Reactor registration of m_event_fd
+            bool                                        m_lost;             // Helper exited (loop thread)
+            std::mutex                                  m_mutex;            // One request in flight at a time
+            std::unordered_map<pid_t,ExitCallback>      m_watchers;         // Children waited for (loop thread)
+            std::unordered_map<pid_t,ExitEvent>         m_exited;           // Reports that arrived before watch() (loop thread)
+            void                                        on_event();         // Dispatch exit statuses (reactor thread)
+            SpawnServer();                                                  // Fork the helper
+    };
+}
+#endif // _WIN32
+#endif // SPAWN_SERVER_H
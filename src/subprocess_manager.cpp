@@ -1,67 +1,332 @@
 #include <subprocess_manager.h>
-#include <format>
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
+#include <chrono>
+#include "affinity.h"
+#include "environment.h"
+#include "log_writer.h"
+#ifdef _WIN32
+#include <io.h>
+#include <psapi.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "reactor.h"
+#include "spawn.h"
+#include "spawn_server.h"
+// Most bytes moved by one splice()/tee() call
+static const size_t LOG_SPLICE_MAX = 1024 * 1024;
+#endif
 using namespace subprocess_manager;
 
-std::map<std::string, std::string> GetEnvironmentMap() {
-    std::map<std::string, std::string> envMap;
-    LPCH envStrings = GetEnvironmentStrings();
-    if (envStrings == nullptr) {
-        return envMap;
+// CPUs a process is pinned to: m_cpus, else the CPUs of m_numa_node
+static std::vector<int> ResolveAffinity(const std::vector<int>& cpus, int numa_node){
+    std::vector<int> resolved = cpus;
+    if(resolved.empty() && numa_node != -1){
+        resolved = numa_node_cpus(numa_node);
+        if(resolved.empty()){
+            throw std::runtime_error("Unknown NUMA node " + std::to_string(numa_node));
+        }
     }
-
-    LPCH envVar = envStrings;
-    while (*envVar) {
-        std::string envEntry(envVar);
-        size_t pos = envEntry.find('=');
-        if (pos != std::string::npos) {
-            std::string key = envEntry.substr(0, pos);
-            std::string value = envEntry.substr(pos + 1);
-            envMap[key] = value;
+#ifdef _WIN32
+    const int limit = (int)(sizeof(DWORD_PTR) * 8);
+#elif defined(__linux__)
+    const int limit = CPU_SETSIZE;
+#else
+    const int limit = 0;
+#endif
+    for(int cpu : resolved){
+        if(cpu < 0 || cpu >= limit){
+            throw std::runtime_error("CPU " + std::to_string(cpu) + " cannot be used for affinity");
         }
-        envVar += lstrlen(envVar) + 1;
     }
-
-    FreeEnvironmentStrings(envStrings);
-    return envMap;
+    return resolved;
+}
+#ifndef _WIN32
+// Split a command line into argv, honouring quotes and backslash escapes
+static std::vector<std::string> SplitCommandLine(const std::string& command){
+    std::vector<std::string> args;
+    std::string current;
+    bool in_arg = false;
+    char quote = '\0';
+    for (size_t i = 0; i < command.size(); i++) {
+        char c = command[i];
+        if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            } else if (c == '\\' && quote == '"' && i + 1 < command.size()) {
+                current += command[++i];
+            } else {
+                current += c;
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+            in_arg = true;
+        } else if (c == '\\' && i + 1 < command.size()) {
+            current += command[++i];
+            in_arg = true;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (in_arg) {
+                args.push_back(current);
+                current.clear();
+                in_arg = false;
+            }
+        } else {
+            current += c;
+            in_arg = true;
+        }
+    }
+    if (in_arg) {
+        args.push_back(current);
+    }
+    return args;
+}
+#endif
+Redirect::Redirect(Redirect_ kind){
+    this->kind = kind;
+    this->fd = -1;
+}
+Redirect::Redirect(std::string path, bool append){
+    this->kind = append ? Redirect_Append : Redirect_File;
+    this->path = path;
+    this->fd = -1;
+}
+Redirect::Redirect(const char* path, bool append) : Redirect(std::string(path), append){
 }
-std::string ConvertMapToString(std::map<std::string,std::string> envMap){
-    // Convert the environment map to a single block
-    std::string envBlock;
-    for (const auto& pair : envMap) {
-        envBlock += pair.first + "=" + pair.second + '\0';
+Redirect::Redirect(int fd){
+    this->kind = Redirect_Fd;
+    this->fd = fd;
+}
+#ifdef _WIN32
+// Inheritable handle for the child's stream, NULL to leave it unset.
+// opened is set when the parent must close the handle after CreateProcess.
+static HANDLE OpenRedirect(const Redirect& redirect, DWORD target, SECURITY_ATTRIBUTES* saAttr, bool& opened){
+    opened = false;
+    bool input = target == STD_INPUT_HANDLE;
+    DWORD access = input ? GENERIC_READ : GENERIC_WRITE;
+    DWORD creation = input ? OPEN_EXISTING : CREATE_ALWAYS;
+    std::string path;
+    switch(redirect.kind){
+        case Redirect_Inherit:
+            return GetStdHandle(target);
+        case Redirect_Null:
+            path = "NUL";
+            break;
+        case Redirect_File:
+            path = redirect.path;
+            break;
+        case Redirect_Append:
+            path = redirect.path;
+            access = input ? GENERIC_READ : FILE_APPEND_DATA;
+            creation = input ? OPEN_EXISTING : OPEN_ALWAYS;
+            break;
+        case Redirect_Fd: {
+            HANDLE handle = NULL;
+            if(!DuplicateHandle(GetCurrentProcess(), (HANDLE)_get_osfhandle(redirect.fd), GetCurrentProcess(),
+                                &handle, 0, TRUE, DUPLICATE_SAME_ACCESS)){
+                throw std::runtime_error("Unable to redirect to fd " + std::to_string(redirect.fd));
+            }
+            opened = true;
+            return handle;
+        }
+        default:
+            return NULL;
     }
-    envBlock += '\0'; // Double null-terminate the block
-    return envBlock;
+    HANDLE handle = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, saAttr, creation,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if(handle == INVALID_HANDLE_VALUE){
+        throw std::runtime_error("Unable to open '" + path + "' for redirection");
+    }
+    opened = true;
+    return handle;
+}
+#else
+// Descriptor the child dup2()s onto target, -1 to leave target as it is.
+// Files are opened here, in the parent, so failures surface as exceptions;
+// opened is set when the parent must close the descriptor after the fork.
+static int OpenRedirect(const Redirect& redirect, int target, bool& opened){
+    opened = false;
+    int flags = target == STDIN_FILENO ? O_RDONLY : O_WRONLY | O_CREAT;
+    const char* path = nullptr;
+    switch(redirect.kind){
+        case Redirect_Null:
+            path = "/dev/null";
+            break;
+        case Redirect_File:
+            path = redirect.path.c_str();
+            flags |= target == STDIN_FILENO ? 0 : O_TRUNC;
+            break;
+        case Redirect_Append:
+            path = redirect.path.c_str();
+            flags |= target == STDIN_FILENO ? 0 : O_APPEND;
+            break;
+        case Redirect_Fd:
+            return redirect.fd;
+        default:
+            return -1;
+    }
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    if(fd == -1){
+        throw std::runtime_error("Unable to open '" + std::string(path) + "' for redirection");
+    }
+    opened = true;
+    return fd;
+}
+// write() to a child's stdin that fails with EPIPE instead of killing the
+// process with SIGPIPE. The signal is blocked on this thread only for the
+// call, and a SIGPIPE it raised is taken off again, so children started from
+// the same thread inherit an untouched mask.
+static ssize_t WritePipe(int fd, const char* data, size_t size){
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    sigset_t previous;
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, &previous);
+    sigset_t pending;
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE) == 1;
+    ssize_t count = write(fd, data, size);
+    int error = errno;
+    if(count == -1 && error == EPIPE && !was_pending){
+        struct timespec none = {0, 0};
+        sigtimedwait(&pipe_signal, nullptr, &none);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    errno = error;
+    return count;
+}
+#endif
+void ResourceUsage::add(const ResourceUsage& other){
+    this->user_time += other.user_time;
+    this->system_time += other.system_time;
+    this->max_rss_kb = std::max(this->max_rss_kb, other.max_rss_kb);
+    this->minor_faults += other.minor_faults;
+    this->major_faults += other.major_faults;
+    this->voluntary_switches += other.voluntary_switches;
+    this->involuntary_switches += other.involuntary_switches;
+    this->input_blocks += other.input_blocks;
+    this->output_blocks += other.output_blocks;
 }
 Subprocess::Subprocess(std::string name, std::string command, std::string curr_directory, std::string log_path,
-                       std::map<std::string,std::string> env_var)
+                       std::map<std::string,std::string> env_var,
+                       Redirect stdin_redirect, Redirect stdout_redirect, Redirect stderr_redirect,
+                       ResourceLimits limits)
+    : m_stdin(stdin_redirect), m_stdout(stdout_redirect), m_stderr(stderr_redirect), m_limits(limits)
 {
     this->m_command = command;
     this->m_curr_directory = curr_directory;
     this->m_log_path = log_path;
     this->m_process_id = -1;
     this->m_return_code = -1;
-    this->p_monitor_thread = nullptr;
-    this->m_output = {};
-    this->m_output_str = "";
+    this->m_exit_reason = Exit_None;
     this->m_name = name;
     this->m_state = Subprocess_NotStarted;
+    this->m_state_changes = 0;
     this->m_duration = 0.0;
-    this->m_env_var = GetEnvironmentMap();
-    this->m_env_var.insert(env_var.begin(), env_var.end());
+    this->m_env_base = Environment::snapshot();
+    this->m_env_var = env_var;
+    this->m_log_token = 0;
+    this->m_numa_node = -1;
+    this->m_priority = 0;
+    this->m_estimate = 1.0;
+    this->m_queue_wait = 0.0;
+    this->m_run_time = 0.0;
+    this->m_timeout = 0.0;
+    this->m_idle_timeout = 0.0;
+    this->m_kill_grace = 5.0;
+    this->m_new_group = true;
+    this->m_stop_reason = Exit_None;
+    this->m_record_order = false;
+#ifdef _WIN32
+    this->p_monitor_thread = nullptr;
+    this->p_error_thread = nullptr;
+    this->m_hErrorRead = NULL;
+    this->m_timer = NULL;
+    this->m_hStdin = NULL;
+    this->m_hRead = NULL;
+    this->m_hWrite = NULL;
     ZeroMemory(&this->m_pi, sizeof(this->m_pi));
     ZeroMemory(&this->m_si, sizeof(this->m_si));
+#else
+    this->m_pid = -1;
+    this->m_read_fd = -1;
+    this->m_write_fd = -1;
+    this->m_pidfd = -1;
+    this->m_read_token = 0;
+    this->m_pidfd_token = 0;
+    this->m_error_fd = -1;
+    this->m_error_token = 0;
+    this->m_exited = false;
+    this->m_pipe_closed = false;
+    this->m_log_fd = -1;
+    this->m_tee_read_fd = -1;
+    this->m_tee_write_fd = -1;
+    this->m_tee_pending = 0;
+    this->m_spliced = false;
+    this->p_spawn_server = nullptr;
+    this->m_timeout_timer = 0;
+    this->m_idle_timer = 0;
+    this->m_kill_timer = 0;
+    this->m_stdin_fd = -1;
+    this->m_stdin_token = 0;
+    this->m_stdin_closing = false;
+    // set until start: queued writes wait for the first flush
+    this->m_stdin_posted = true;
+#endif
 }
 Subprocess::~Subprocess(){
+    this->terminate();
+#ifdef _WIN32
     CloseHandle(this->m_pi.hProcess);
     CloseHandle(this->m_pi.hThread);
     CloseHandle(this->m_hRead);
     CloseHandle(this->m_hWrite);
-    this->terminate();
+    if(this->m_hStdin != NULL){
+        CloseHandle(this->m_hStdin);
+    }
+    if(this->m_hErrorRead != NULL){
+        CloseHandle(this->m_hErrorRead);
+    }
+#else
+    if(this->m_stdin.kind == Redirect_Pipe){
+        // posted tasks run in order: a flush posted by write_stdin() is done
+        // once this returns
+        Reactor::instance().call([](){});
+        if(this->m_stdin_fd != -1){
+            close(this->m_stdin_fd);
+        }
+        // never started: the queued writes are dropped
+        for(StdinChunk& chunk : this->m_stdin_queue){
+            if(chunk.on_done){
+                chunk.on_done(false);
+            }
+        }
+    }
+    if(this->m_read_fd != -1){
+        close(this->m_read_fd);
+    }
+    if(this->m_write_fd != -1){
+        close(this->m_write_fd);
+    }
+    if(this->m_pidfd != -1){
+        close(this->m_pidfd);
+    }
+    if(this->m_error_fd != -1){
+        close(this->m_error_fd);
+    }
+    this->close_splice();
+#endif
 }
+#ifdef _WIN32
 Subprocess* Subprocess::start(){
     this->execute();
     this->monitor();
@@ -73,15 +338,171 @@ Subprocess* Subprocess::start_async(){
     this->p_monitor_thread = new std::thread(std::bind(&Subprocess::monitor, this));
     return this;
 }
+#else
+Subprocess* Subprocess::start(){
+    this->start_async();
+    this->join();
+    return this;
+}
+Subprocess* Subprocess::start_async(){
+    this->execute();
+    // if log is specified, open the log file (it mirrors the piped output)
+    if(this->m_log_path != "" && this->m_read_fd != -1){
+        this->open_log();
+    }
+    // Hand the pipe and pidfd to the shared reactor. Registration runs on the
+    // loop thread so handlers never observe a half initialised token.
+    Reactor::instance().post([this](){
+        Reactor& reactor = Reactor::instance();
+        // Armed first: once the exit is watched this object may complete
+        // and be gone before the task returns
+        this->arm_timers();
+        if(this->m_read_fd != -1){
+            this->m_read_token = reactor.add(this->m_read_fd, EPOLLIN, [this](uint32_t){ this->on_output(); });
+        }
+        if(this->m_error_fd != -1){
+            this->m_error_token = reactor.add(this->m_error_fd, EPOLLIN, [this](uint32_t){ this->on_error_output(); });
+        }
+        if(this->m_stdin_fd != -1){
+            // writes queued before the start
+            this->flush_stdin();
+        }
+        if(this->p_spawn_server != nullptr){
+            // the helper reaps the child and forwards its status
+            this->p_spawn_server->watch(this->m_pid, [this](int status, const struct rusage* usage){
+                this->set_exit_status(status, usage);
+                this->try_complete();
+            });
+        }else if(this->m_pidfd != -1){
+            this->m_pidfd_token = reactor.add(this->m_pidfd, EPOLLIN, [this](uint32_t){ this->on_exit(); });
+        }else if(this->m_pipe_closed){
+            // no pipe and no pidfd: start polling for the exit right away
+            this->try_complete();
+        }
+    });
+    return this;
+}
+#endif
+void Subprocess::complete(){
+#ifndef _WIN32
+    this->drop_stdin();
+    this->close_splice();
+#endif
+    // The process only completes once its log is on disk; the writer thread
+    // publishes so this (reactor) thread never waits for the file.
+    if(this->m_log_token != 0){
+        uint64_t token = this->m_log_token;
+        this->m_log_token = 0;
+        LogWriter::instance().close(token, [this](){ this->publish(); });
+        return;
+    }
+    this->publish();
+}
+void Subprocess::publish(){
+    if(this->m_on_exit){
+        this->m_on_exit(*this);
+    }
+    // Take a copy of the hooks: once waiters are woken this object may be gone.
+    std::function<void()> on_complete = this->m_on_complete;
+    if(on_complete){
+        // managed: m_run_time is final before waiters can read it
+        this->m_run_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->m_dequeued).count();
+    }
+    std::function<void(const RunResult&)> on_result = std::move(this->m_on_result);
+    this->m_on_result = nullptr;
+    RunResult result = this->make_result();
+    this->set_state(Subprocess_Completed);
+    if(on_complete){
+        on_complete();
+    }
+    if(on_result){
+        on_result(result);
+    }
+}
+std::future<RunResult> Subprocess::start_future(){
+    // std::promise is move-only, std::function needs a copyable target
+    auto promise = std::make_shared<std::promise<RunResult>>();
+    std::future<RunResult> future = promise->get_future();
+    this->m_on_result = [promise](const RunResult& result){ promise->set_value(result); };
+    try{
+        this->start_async();
+    }catch(...){
+        this->m_on_result = nullptr;
+        throw;
+    }
+    return future;
+}
+RunAwaitable Subprocess::run(){
+    return RunAwaitable(this);
+}
+RunAwaitable::RunAwaitable(Subprocess* process){
+    this->p_process = process;
+}
+bool RunAwaitable::await_ready() const noexcept{
+    return false;
+}
+void RunAwaitable::await_suspend(std::coroutine_handle<> handle){
+    this->p_process->m_on_result = [handle](const RunResult&){
+#ifdef _WIN32
+        // off the monitor thread, which the coroutine may join by destroying the process
+        std::thread([handle](){ handle.resume(); }).detach();
+#else
+        // as a task of its own, so the coroutine never runs inside publish()
+        Reactor::instance().post([handle](){ handle.resume(); });
+#endif
+    };
+    Subprocess* process = this->p_process;
+    try{
+        process->start_async();
+    }catch(...){
+        // not suspended after all: the exception is thrown from co_await
+        process->m_on_result = nullptr;
+        throw;
+    }
+    // the coroutine may already be running again on the reactor thread, so
+    // nothing in its frame (this awaitable included) may be touched here
+}
+RunResult RunAwaitable::await_resume(){
+    return this->p_process->make_result();
+}
+RunResult Subprocess::make_result(){
+    RunResult result;
+    result.process = this;
+    result.return_code = this->m_return_code;
+    result.exit_reason = this->m_exit_reason;
+    result.duration = this->m_duration;
+    return result;
+}
+void Subprocess::set_state(Subprocess_ state){
+    // Both wakeups are sent under the lock: a waiter that saw the new state
+    // cannot destroy this object before the notifier is done with it, since
+    // the destructor's join() takes the same lock.
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    this->m_state.store(state, std::memory_order_release);
+    this->m_state_changes.fetch_add(1, std::memory_order_release);
+    this->m_state_changes.notify_all();
+    this->m_cv.notify_all();
+}
+#ifdef _WIN32
 void Subprocess::execute(){
     if(this->m_state != Subprocess_NotStarted){
-        throw std::runtime_error(std::format("'{0}' already running",this->m_command));
+        throw std::runtime_error("'" + this->m_command + "' already running");
+    }
+    const ResourceLimits& limits = this->m_limits;
+    if(limits.address_space >= 0 || limits.cpu_time >= 0 || limits.open_files >= 0 || limits.core_size >= 0){
+        throw std::runtime_error("Resource limits are not supported on Windows ('" + this->m_command + "')");
     }
-    this->m_state = Subprocess_Started;
-    this->m_start_time = clock();
-    this->m_output = {};
-    this->m_output_str = "";
+    this->set_state(Subprocess_Started);
+    this->m_start_time = std::chrono::steady_clock::now();
+    this->m_end_time = this->m_start_time;
+    this->m_duration = 0.0;
+    this->m_usage = ResourceUsage();
+    this->m_output.clear();
+    this->m_error_output.clear();
+    this->m_output_order.clear();
     this->m_return_code = -1;
+    this->m_exit_reason = Exit_None;
+    this->m_stop_reason = Exit_None;
     // update security attribs
     SECURITY_ATTRIBUTES saAttr;
     BOOL fSuccess;
@@ -91,27 +512,103 @@ void Subprocess::execute(){
     saAttr.bInheritHandle = TRUE;
     saAttr.lpSecurityDescriptor = NULL;
 
-    // Create a pipe for the child process's STDOUT.
-    fSuccess = CreatePipe(&this->m_hRead, &this->m_hWrite, &saAttr, 0);
-    if (!fSuccess) {
-        // Handle error
-        throw std::runtime_error("Unable to create r/w pipe");
+    if (this->m_stdin.kind == Redirect_Stdout || this->m_stdout.kind == Redirect_Stdout) {
+        this->set_state(Subprocess_NotStarted);
+        throw std::runtime_error("Redirect_Stdout is only valid for stderr");
     }
-    // Ensure the read handle to the pipe for STDOUT is not inherited.
-    fSuccess = SetHandleInformation(this->m_hRead, HANDLE_FLAG_INHERIT, 0);
-    if (!fSuccess) {
-        // Handle error
-        throw std::runtime_error("Unable to create pipe to communicate with child process");
+    std::vector<int> cpus;
+    try {
+        cpus = ResolveAffinity(this->m_cpus, this->m_numa_node);
+    } catch (...) {
+        this->set_state(Subprocess_NotStarted);
+        throw;
+    }
+    // Resolve the standard streams; only a piped stdout needs a reader
+    const Redirect* redirects[3] = {&this->m_stdin, &this->m_stdout, &this->m_stderr};
+    DWORD targets[3] = {STD_INPUT_HANDLE, STD_OUTPUT_HANDLE, STD_ERROR_HANDLE};
+    HANDLE handles[3] = {NULL, NULL, NULL};
+    bool opened[3] = {false, false, false};
+    auto close_redirects = [&](){
+        for (int i = 0; i < 3; i++) {
+            if (opened[i]) {
+                CloseHandle(handles[i]);
+            }
+        }
+        if (this->m_hStdin != NULL) {
+            CloseHandle(this->m_hStdin);
+            this->m_hStdin = NULL;
+        }
+        if (this->m_hErrorRead != NULL) {
+            CloseHandle(this->m_hErrorRead);
+            this->m_hErrorRead = NULL;
+        }
+    };
+    try {
+        for (int i = 0; i < 3; i++) {
+            handles[i] = OpenRedirect(*redirects[i], targets[i], &saAttr, opened[i]);
+        }
+    } catch (...) {
+        close_redirects();
+        this->set_state(Subprocess_NotStarted);
+        throw;
+    }
+    if (this->m_stdout.kind == Redirect_Pipe) {
+        // Create a pipe for the child process's STDOUT.
+        fSuccess = CreatePipe(&this->m_hRead, &this->m_hWrite, &saAttr, 0);
+        if (!fSuccess) {
+            // Handle error
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create r/w pipe");
+        }
+        // Ensure the read handle to the pipe for STDOUT is not inherited.
+        fSuccess = SetHandleInformation(this->m_hRead, HANDLE_FLAG_INHERIT, 0);
+        if (!fSuccess) {
+            // Handle error
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create pipe to communicate with child process");
+        }
+        handles[1] = this->m_hWrite;
+    }
+    if (this->m_stdin.kind == Redirect_Pipe) {
+        // The child inherits the read end, the parent keeps the write end
+        HANDLE hChildStdin = NULL;
+        if (!CreatePipe(&hChildStdin, &this->m_hStdin, &saAttr, 0) ||
+            !SetHandleInformation(this->m_hStdin, HANDLE_FLAG_INHERIT, 0)) {
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create stdin pipe");
+        }
+        handles[0] = hChildStdin;
+        opened[0] = true;
+    }
+    if (this->m_stderr.kind == Redirect_Pipe) {
+        // A pipe of its own, drained into m_error_output by p_error_thread
+        HANDLE hChildStderr = NULL;
+        if (!CreatePipe(&this->m_hErrorRead, &hChildStderr, &saAttr, 0) ||
+            !SetHandleInformation(this->m_hErrorRead, HANDLE_FLAG_INHERIT, 0)) {
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create stderr pipe");
+        }
+        handles[2] = hChildStderr;
+        opened[2] = true;
+    } else if (this->m_stderr.kind == Redirect_Stdout) {
+        // 2>&1: both streams share one handle, so their order is kept
+        handles[2] = handles[1];
     }
 
     // Create the child process.
     this->m_si.cb = sizeof(this->m_si);
     this->m_si.dwFlags |= STARTF_USESTDHANDLES;
     this->m_si.wShowWindow = SW_HIDE;
-    this->m_si.hStdOutput = this->m_hWrite;
-    // Convert the environment map to a single block
-    std::string env_str = ConvertMapToString(this->m_env_var);
-    LPVOID lpEnv = (LPVOID)env_str.c_str();
+    this->m_si.hStdInput = handles[0];
+    this->m_si.hStdOutput = handles[1];
+    this->m_si.hStdError = handles[2];
+    // Snapshot and overlay merged into a single block
+    EnvironmentBlock env = this->m_env_base->build(this->m_env_var);
+    LPVOID lpEnv = (LPVOID)env.text;
     // Replace with your desired command
     LPSTR lpCmdline = const_cast<char *>(this->m_command.c_str());
     LPSTR lpCurrDir = NULL;
@@ -124,7 +621,7 @@ void Subprocess::execute(){
         NULL,
         NULL,
         TRUE,
-        CREATE_NO_WINDOW,
+        CREATE_NO_WINDOW | (cpus.empty() ? 0 : CREATE_SUSPENDED),
         lpEnv,
         lpCurrDir,
         &this->m_si,
@@ -132,97 +629,1086 @@ void Subprocess::execute(){
         )
     ) {
         // Handle error
-        throw std::runtime_error(std::format("Unable to create process '{0}'",lpCmdline));
+        close_redirects();
+        this->set_state(Subprocess_NotStarted);
+        throw std::runtime_error("Unable to create process '" + std::string(lpCmdline) + "'");
     }
-    // Close handle to the write end of the pipe.
+    if (!cpus.empty()) {
+        // the child is still suspended: pin it before it runs any code
+        DWORD_PTR mask = 0;
+        for (int cpu : cpus) {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+        if (!SetProcessAffinityMask(this->m_pi.hProcess, mask)) {
+            TerminateProcess(this->m_pi.hProcess, 1);
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to set the affinity of '" + std::string(lpCmdline) + "'");
+        }
+        ResumeThread(this->m_pi.hThread);
+    }
+    // Close handle to the write end of the pipe and the redirection targets.
     // No longer needed by the parent process.
-    CloseHandle(this->m_hWrite);
+    for (int i = 0; i < 3; i++) {
+        if (opened[i]) {
+            CloseHandle(handles[i]);
+        }
+    }
+    if (this->m_hWrite != NULL) {
+        CloseHandle(this->m_hWrite);
+        this->m_hWrite = NULL;
+    }
     // update process id
     this->m_process_id = this->m_pi.dwProcessId;
     // start monitoring
-    this->m_state = Subprocess_InProgress;
+    this->set_state(Subprocess_InProgress);
 }
 
+void Subprocess::record_usage(){
+    this->m_end_time = std::chrono::steady_clock::now();
+    this->m_duration = std::chrono::duration<double>(this->m_end_time - this->m_start_time).count();
+    // FILETIMEs count 100 ns ticks
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (GetProcessTimes(this->m_pi.hProcess, &creation_time, &exit_time, &kernel_time, &user_time)) {
+        ULARGE_INTEGER ticks;
+        ticks.LowPart = user_time.dwLowDateTime;
+        ticks.HighPart = user_time.dwHighDateTime;
+        this->m_usage.user_time = ticks.QuadPart / 1e7;
+        ticks.LowPart = kernel_time.dwLowDateTime;
+        ticks.HighPart = kernel_time.dwHighDateTime;
+        this->m_usage.system_time = ticks.QuadPart / 1e7;
+    }
+    PROCESS_MEMORY_COUNTERS memory;
+    if (GetProcessMemoryInfo(this->m_pi.hProcess, &memory, sizeof(memory))) {
+        this->m_usage.max_rss_kb = (long)(memory.PeakWorkingSetSize / 1024);
+        this->m_usage.minor_faults = (long)memory.PageFaultCount;
+    }
+}
+void Subprocess::kill_process(){
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    if(this->m_state != Subprocess_InProgress || this->m_pi.hProcess == NULL){
+        return;
+    }
+    if(this->m_stop_reason == Exit_None){
+        this->m_stop_reason = Exit_Terminated;
+    }
+    TerminateProcess(this->m_pi.hProcess, 1);
+}
+VOID CALLBACK Subprocess::on_timer(PVOID context, BOOLEAN fired){
+    static_cast<Subprocess*>(context)->check_timeouts();
+}
+void Subprocess::check_timeouts(){
+    // No SIGTERM on Windows: an expired timeout terminates the child at once
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    if(this->m_stop_reason != Exit_None){
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if(this->m_timeout > 0 && std::chrono::duration<double>(now - this->m_start_time).count() >= this->m_timeout){
+        this->m_stop_reason = Exit_Timeout;
+    }else if(this->m_idle_timeout > 0 && this->m_hRead != NULL && std::chrono::duration<double>(now - this->m_last_output).count() >= this->m_idle_timeout){
+        this->m_stop_reason = Exit_IdleTimeout;
+    }else{
+        return;
+    }
+    // the blocked ReadFile() returns once the child is gone
+    TerminateProcess(this->m_pi.hProcess, 1);
+}
 void Subprocess::monitor()
 {
-    std::ofstream log_file;
-    // if log is specified, open the log file
-    if(this->m_log_path != ""){
-        log_file.open(this->m_log_path); 
+    // if log is specified, open the log file (it mirrors the piped output)
+    if(this->m_log_path != "" && this->m_hRead != NULL){
+        this->m_log_token = LogWriter::instance().open(this->m_log_path, this->m_log_policy);
+    }
+    // The timeouts are checked from the system timer queue's shared threads
+    this->m_last_output = this->m_start_time;
+    if(this->m_timeout > 0 || this->m_idle_timeout > 0){
+        if(!CreateTimerQueueTimer(&this->m_timer, NULL, &Subprocess::on_timer, this, 100, 100, WT_EXECUTEDEFAULT)){
+            this->m_timer = NULL;
+        }
+    }
+    if(this->m_hErrorRead != NULL){
+        this->p_error_thread = new std::thread(&Subprocess::read_errors, this);
+    }
+    if(this->m_hRead == NULL){
+        // nothing to read: just wait for the exit
+        WaitForSingleObject(this->m_pi.hProcess, INFINITE);
     }
     while (this->m_state == Subprocess_InProgress) {
         DWORD exitCode;
         if (!GetExitCodeProcess(this->m_pi.hProcess, &exitCode)) {
             this->m_return_code = -2;
+            this->m_exit_reason = Exit_Lost;
             break;
         }
 
         if (exitCode != STILL_ACTIVE) {
             this->m_return_code = (int)exitCode;
+            this->m_exit_reason = Exit_Normal;
+            this->record_usage();
             break;
         }
         // Read from pipe until end-of-file is reached.
-        char buffer[4096];
+        // Data lands directly in the output arena.
+        size_t available;
+        char* buffer = this->m_output.prepare(available);
         DWORD dwRead;
-        while (ReadFile(this->m_hRead, buffer, sizeof(buffer) - 1, &dwRead, NULL) && dwRead != 0) {
-            buffer[dwRead] = '\0';
-            std::string out_str = std::string(buffer);
-            this->m_output_str += out_str;
-            // remove trailing newline
-            if(out_str.back() == '\n'){
-                out_str.pop_back();
+        while (ReadFile(this->m_hRead, buffer, (DWORD)available, &dwRead, NULL) && dwRead != 0) {
+            if (this->m_timer != NULL) {
+                std::lock_guard<std::mutex> lock(this->m_mutex);
+                this->m_last_output = std::chrono::steady_clock::now();
             }
-            // add current buffer to output stream
-            this->m_output.push_back(out_str);
-            // if log is specified, write to log file
-            if(this->m_log_path != ""){
-                log_file << std::string(buffer);
-                log_file.flush();
+            // the log gets the raw bytes, before commit() filters them in place
+            LogWriter::instance().write(this->m_log_token, buffer, dwRead);
+            this->commit_output(Stream_Stdout, dwRead);
+            buffer = this->m_output.prepare(available);
+        }
+    }
+    if (this->m_timer != NULL) {
+        // waits for a running callback
+        DeleteTimerQueueTimer(NULL, this->m_timer, INVALID_HANDLE_VALUE);
+        this->m_timer = NULL;
+    }
+    if (this->m_stop_reason != Exit_None) {
+        this->m_exit_reason = this->m_stop_reason;
+    }
+    if (this->p_error_thread != nullptr) {
+        // returns once the child and whatever it started closed stderr
+        this->p_error_thread->join();
+        delete this->p_error_thread;
+        this->p_error_thread = nullptr;
+    }
+    {
+        // later writes fail instead of blocking on a pipe nobody reads
+        std::lock_guard<std::mutex> lock(this->m_stdin_mutex);
+        if (this->m_hStdin != NULL) {
+            CloseHandle(this->m_hStdin);
+            this->m_hStdin = NULL;
+        }
+    }
+    this->finish_output(Stream_Stdout);
+    this->complete();
+}
+void Subprocess::read_errors(){
+    size_t available;
+    char* buffer = this->m_error_output.prepare(available);
+    DWORD dwRead;
+    while (ReadFile(this->m_hErrorRead, buffer, (DWORD)available, &dwRead, NULL) && dwRead != 0) {
+        if (this->m_timer != NULL) {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_last_output = std::chrono::steady_clock::now();
+        }
+        this->commit_output(Stream_Stderr, dwRead);
+        buffer = this->m_error_output.prepare(available);
+    }
+    this->finish_output(Stream_Stderr);
+    CloseHandle(this->m_hErrorRead);
+    this->m_hErrorRead = NULL;
+}
+void Subprocess::queue_stdin(std::string owned, const char* data, size_t size, std::function<void(bool)> on_done){
+    // No reactor here: the write blocks the caller until the child has
+    // read the data (or exited)
+    if(!owned.empty()){
+        data = owned.data();
+    }
+    bool written = false;
+    {
+        std::lock_guard<std::mutex> lock(this->m_stdin_mutex);
+        if(this->m_hStdin != NULL){
+            written = true;
+            while(size > 0){
+                DWORD count = 0;
+                if(!WriteFile(this->m_hStdin, data, (DWORD)std::min(size, (size_t)1 << 30), &count, NULL)){
+                    written = false;
+                    break;
+                }
+                data += count;
+                size -= count;
             }
         }
     }
-    if(this->m_log_path != ""){
-        log_file.close();
+    if(on_done){
+        on_done(written);
+    }
+}
+Subprocess* Subprocess::close_stdin(){
+    if(this->m_stdin.kind != Redirect_Pipe){
+        throw std::runtime_error("'" + this->m_command + "' has no stdin pipe");
+    }
+    std::lock_guard<std::mutex> lock(this->m_stdin_mutex);
+    if(this->m_hStdin != NULL){
+        CloseHandle(this->m_hStdin);
+        this->m_hStdin = NULL;
     }
-    auto end = clock();
-    this->m_duration = double(this->m_start_time - end)/CLOCKS_PER_SEC ;
-    this->m_state = Subprocess_Completed;
+    return this;
 }
+#else
+void Subprocess::execute(){
+    if(this->m_state != Subprocess_NotStarted){
+        throw std::runtime_error("'" + this->m_command + "' already running");
+    }
+    this->set_state(Subprocess_Started);
+    this->m_start_time = std::chrono::steady_clock::now();
+    this->m_end_time = this->m_start_time;
+    this->m_duration = 0.0;
+    this->m_usage = ResourceUsage();
+    this->m_output.clear();
+    this->m_error_output.clear();
+    this->m_output_order.clear();
+    this->m_return_code = -1;
+    this->m_exit_reason = Exit_None;
+    this->m_stop_reason = Exit_None;
+
+    // Resolve the standard streams: src[i] is dup2()ed onto fd i in the
+    // child, -1 leaves the inherited stream alone.
+    if (this->m_stdin.kind == Redirect_Stdout || this->m_stdout.kind == Redirect_Stdout) {
+        this->set_state(Subprocess_NotStarted);
+        throw std::runtime_error("Redirect_Stdout is only valid for stderr");
+    }
+    std::vector<int> cpus;
+    try {
+        cpus = ResolveAffinity(this->m_cpus, this->m_numa_node);
+    } catch (...) {
+        this->set_state(Subprocess_NotStarted);
+        throw;
+    }
+    const Redirect* redirects[3] = {&this->m_stdin, &this->m_stdout, &this->m_stderr};
+    int src[3] = {-1, -1, -1};
+    bool opened[3] = {false, false, false};
+    auto close_redirects = [&](){
+        for (int i = 0; i < 3; i++) {
+            if (opened[i]) {
+                close(src[i]);
+            }
+        }
+        if (this->m_read_fd != -1) {
+            close(this->m_read_fd);
+            this->m_read_fd = -1;
+        }
+        if (this->m_write_fd != -1) {
+            close(this->m_write_fd);
+            this->m_write_fd = -1;
+        }
+        if (this->m_stdin_fd != -1) {
+            close(this->m_stdin_fd);
+            this->m_stdin_fd = -1;
+        }
+        if (this->m_error_fd != -1) {
+            close(this->m_error_fd);
+            this->m_error_fd = -1;
+        }
+    };
+    try {
+        for (int i = 0; i < 3; i++) {
+            src[i] = OpenRedirect(*redirects[i], i, opened[i]);
+        }
+    } catch (...) {
+        close_redirects();
+        this->set_state(Subprocess_NotStarted);
+        throw;
+    }
+    if (this->m_stdout.kind == Redirect_Pipe) {
+        // Create a pipe for the child process's STDOUT.
+        // Both ends are close-on-exec; the child dup2()s the write end onto fd 1.
+        int out_pipe[2];
+        if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create r/w pipe");
+        }
+        this->m_read_fd = out_pipe[0];
+        this->m_write_fd = out_pipe[1];
+        src[STDOUT_FILENO] = this->m_write_fd;
+    }
+    if (this->m_stdin.kind == Redirect_Pipe) {
+        // The child reads fd 0 from the read end, closed here after the
+        // spawn; the parent keeps the write end for write_stdin()
+        int in_pipe[2];
+        if (pipe2(in_pipe, O_CLOEXEC) != 0) {
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create stdin pipe");
+        }
+        src[STDIN_FILENO] = in_pipe[0];
+        opened[STDIN_FILENO] = true;
+        this->m_stdin_fd = in_pipe[1];
+    }
+    if (this->m_stderr.kind == Redirect_Pipe) {
+        // A pipe of its own, drained into m_error_output
+        int err_pipe[2];
+        if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+            close_redirects();
+            this->set_state(Subprocess_NotStarted);
+            throw std::runtime_error("Unable to create stderr pipe");
+        }
+        this->m_error_fd = err_pipe[0];
+        src[STDERR_FILENO] = err_pipe[1];
+        opened[STDERR_FILENO] = true;
+    } else if (this->m_stderr.kind == Redirect_Stdout) {
+        // 2>&1: both streams share one descriptor, so the parent reads them
+        // in the order the child wrote them
+        src[STDERR_FILENO] = src[STDOUT_FILENO] != -1 ? src[STDOUT_FILENO] : STDOUT_FILENO;
+    }
+    // Build argv and envp before spawning so the child only has to exec.
+    std::vector<std::string> args = SplitCommandLine(this->m_command);
+    std::string path = args.empty() ? "" : find_executable(args[0]);
+    if (path.empty()) {
+        close_redirects();
+        this->set_state(Subprocess_NotStarted);
+        throw std::runtime_error("Unable to create process '" + this->m_command + "'");
+    }
+    std::vector<char*> argv;
+    for (std::string& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    // Snapshot and overlay merged into envp with a single allocation
+    EnvironmentBlock env = this->m_env_base->build(this->m_env_var);
+    SpawnRequest request;
+    request.path = path.c_str();
+    request.argv = argv.data();
+    request.envp = env.envp;
+    request.curr_dir = nullptr;
+    if(this->m_curr_directory != ""){
+        request.curr_dir = this->m_curr_directory.c_str();
+    }
+    for (int i = 0; i < 3; i++) {
+        request.fds[i] = src[i];
+    }
+    request.new_group = this->m_new_group;
+#ifdef __linux__
+    // applied by the child between clone and exec
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &affinity);
+    }
+    request.affinity = cpus.empty() ? nullptr : &affinity;
+#endif
+    // applied by the child before exec
+    SpawnLimit limits[SPAWN_MAX_LIMITS];
+    request.limits = limits;
+    request.limit_count = 0;
+    const struct { int resource; long long value; } wanted[SPAWN_MAX_LIMITS] = {
+        {RLIMIT_AS, this->m_limits.address_space},
+        {RLIMIT_CPU, this->m_limits.cpu_time},
+        {RLIMIT_NOFILE, this->m_limits.open_files},
+        {RLIMIT_CORE, this->m_limits.core_size},
+    };
+    for (const auto& limit : wanted) {
+        if (limit.value < 0) {
+            continue;
+        }
+        SpawnLimit& entry = limits[request.limit_count++];
+        entry.resource = limit.resource;
+        entry.value.rlim_cur = (rlim_t)limit.value;
+        entry.value.rlim_max = (rlim_t)limit.value;
+        if (limit.resource == RLIMIT_CPU) {
+            // SIGXCPU at the soft limit lets the child stop cleanly, the
+            // hard limit a second later kills it
+            entry.value.rlim_max = (rlim_t)limit.value + 1;
+        }
+    }
+
+    // Create the child process, through the spawn server when one runs.
+    pid_t pid = -1;
+    this->p_spawn_server = SpawnServer::instance();
+    if (this->p_spawn_server != nullptr) {
+        pid = this->p_spawn_server->spawn(request);
+        if (pid == -1 && (errno == EMSGSIZE || errno == EPIPE)) {
+            // request larger than a socket message, or the helper is gone
+            this->p_spawn_server = nullptr;
+        }
+    }
+    if (this->p_spawn_server == nullptr) {
+        pid = spawn_process(request);
+    }
+    // Close the write end of the pipe and the redirection targets.
+    // No longer needed by the parent process.
+    for (int i = 0; i < 3; i++) {
+        if (opened[i]) {
+            close(src[i]);
+            opened[i] = false;
+        }
+    }
+    if (this->m_write_fd != -1) {
+        close(this->m_write_fd);
+        this->m_write_fd = -1;
+    }
+    if (pid == -1) {
+        close_redirects();
+        this->set_state(Subprocess_NotStarted);
+        throw std::runtime_error("Unable to create process '" + this->m_command + "'");
+    }
+    if (this->m_read_fd != -1) {
+        // The reactor drains the pipe without blocking its loop
+        fcntl(this->m_read_fd, F_SETFL, fcntl(this->m_read_fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (this->m_error_fd != -1) {
+        fcntl(this->m_error_fd, F_SETFL, fcntl(this->m_error_fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (this->m_stdin_fd != -1) {
+        // and feeds stdin only as fast as the child reads it
+        fcntl(this->m_stdin_fd, F_SETFL, fcntl(this->m_stdin_fd, F_GETFL) | O_NONBLOCK);
+    }
+    // update process id
+    this->m_pid = pid;
+    this->m_process_id = (int)pid;
+    this->m_exited = false;
+    // without a pipe there is nothing to read: completion only waits for the exit
+    this->m_pipe_closed = this->m_read_fd == -1;
+#ifdef SYS_pidfd_open
+    if (this->p_spawn_server == nullptr) {
+        this->m_pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    }
+#endif
+    // start monitoring
+    this->set_state(Subprocess_InProgress);
+}
+
+void Subprocess::open_log(){
+#ifdef __linux__
+    if(this->m_log_policy.splice){
+        this->m_spliced = false;
+        this->m_tee_pending = 0;
+        this->m_log_fd = open(this->m_log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if(this->m_log_fd != -1 && (this->m_output.capture() != Capture_None || this->m_on_chunk || this->m_on_line)){
+            // the output is also read (to capture it or hand it to the
+            // callbacks); tee() only copies pipe to pipe: duplicate into a
+            // private pipe and splice that one into the file
+            int tee_pipe[2];
+            if(pipe2(tee_pipe, O_CLOEXEC) == 0){
+                this->m_tee_read_fd = tee_pipe[0];
+                this->m_tee_write_fd = tee_pipe[1];
+                fcntl(this->m_tee_write_fd, F_SETPIPE_SZ, (int)LOG_SPLICE_MAX);
+            }else{
+                close(this->m_log_fd);
+                this->m_log_fd = -1;
+            }
+        }
+        if(this->m_log_fd != -1){
+            return;
+        }
+    }
+#endif
+    this->m_log_token = LogWriter::instance().open(this->m_log_path, this->m_log_policy);
+}
+ssize_t Subprocess::splice_log(){
+#ifdef __linux__
+    if(this->m_tee_read_fd == -1){
+        return splice(this->m_read_fd, nullptr, this->m_log_fd, nullptr, LOG_SPLICE_MAX, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+    ssize_t count = tee(this->m_read_fd, this->m_tee_write_fd, LOG_SPLICE_MAX, SPLICE_F_NONBLOCK);
+    // the tee pipe is always drained, so it holds exactly the count bytes
+    for(ssize_t left = count; left > 0;){
+        ssize_t moved = splice(this->m_tee_read_fd, nullptr, this->m_log_fd, nullptr, (size_t)left, SPLICE_F_MOVE);
+        if(moved == -1 && errno == EINTR){
+            continue;
+        }
+        if(moved <= 0){
+            // what was moved is in the file: the reads that follow skip it
+            this->m_tee_pending = (size_t)(count - left);
+            errno = EIO;
+            return -1;
+        }
+        left -= moved;
+    }
+    return count;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+void Subprocess::close_splice(){
+    int* fds[] = {&this->m_log_fd, &this->m_tee_read_fd, &this->m_tee_write_fd};
+    for(int* fd : fds){
+        if(*fd != -1){
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+void Subprocess::on_output(){
+    this->m_last_output = std::chrono::steady_clock::now();
+    // Bounded number of reads per wakeup so one chatty child cannot starve
+    // the others; epoll is level triggered and calls back for the rest.
+    // Data lands directly in the output arena.
+    for (int i = 0; i < 16; i++) {
+        if (this->m_log_fd != -1 && this->m_tee_pending == 0) {
+            // Log without copying through user space: the output is moved
+            // (or tee()d and then moved) to the file before it is read.
+            ssize_t count = this->splice_log();
+            if (count == -1 && (errno == EINTR || errno == EAGAIN)) {
+                if (errno == EAGAIN) {
+                    return;
+                }
+                continue;
+            }
+            if (count == -1) {
+                // splice not supported for this file, or the file failed
+                // part way (ENOSPC, EIO): copy the rest through the writer,
+                // after what is already in the file
+                bool logged = this->m_spliced || this->m_tee_pending != 0;
+                this->close_splice();
+                this->m_log_token = LogWriter::instance().open(this->m_log_path, this->m_log_policy, logged);
+            } else if (count > 0) {
+                this->m_spliced = true;
+                this->m_tee_pending = (size_t)count;
+                if (this->m_tee_read_fd == -1) {
+                    // moved, not tee()d: nothing is left to read
+                    this->m_tee_pending = 0;
+                    continue;
+                }
+            } else if (this->m_tee_read_fd == -1) {
+                this->finish_output(Stream_Stdout);
+                this->close_output();
+                return;
+            }
+        }
+        size_t available;
+        char* buffer = this->m_output.prepare(available);
+        if (this->m_tee_pending != 0 && available > this->m_tee_pending) {
+            // stop where the logged part ends so nothing is tee()d twice
+            available = this->m_tee_pending;
+        }
+        ssize_t count = read(this->m_read_fd, buffer, available);
+        if (count > 0) {
+            if (this->m_tee_pending != 0) {
+                this->m_tee_pending -= (size_t)count;
+            } else {
+                // the log gets the raw bytes, before commit() filters them in place
+                LogWriter::instance().write(this->m_log_token, buffer, (size_t)count);
+            }
+            this->commit_output(Stream_Stdout, (size_t)count);
+            continue;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1 && errno == EAGAIN) {
+            return;
+        }
+        // end-of-file (or a broken pipe): the child closed its stdout
+        this->finish_output(Stream_Stdout);
+        this->close_output();
+        return;
+    }
+}
+void Subprocess::on_error_output(){
+    this->m_last_output = std::chrono::steady_clock::now();
+    // stderr is neither logged nor spliced: straight into its arena
+    for (int i = 0; i < 16; i++) {
+        size_t available;
+        char* buffer = this->m_error_output.prepare(available);
+        ssize_t count = read(this->m_error_fd, buffer, available);
+        if (count > 0) {
+            this->commit_output(Stream_Stderr, (size_t)count);
+            continue;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1 && errno == EAGAIN) {
+            return;
+        }
+        this->finish_output(Stream_Stderr);
+        Reactor::instance().remove(this->m_error_token);
+        close(this->m_error_fd);
+        this->m_error_fd = -1;
+        this->try_complete();
+        return;
+    }
+}
+void Subprocess::close_output(){
+    Reactor::instance().remove(this->m_read_token);
+    close(this->m_read_fd);
+    this->m_read_fd = -1;
+    this->m_pipe_closed = true;
+    this->try_complete();
+}
+void Subprocess::on_exit(){
+    if (!this->reap(false)) {
+        return;
+    }
+    Reactor::instance().remove(this->m_pidfd_token);
+    close(this->m_pidfd);
+    this->m_pidfd = -1;
+    this->try_complete();
+}
+bool Subprocess::reap(bool block){
+    // Reap the child and translate its wait status into a return code
+    int status = 0;
+    struct rusage usage = {};
+    pid_t waited;
+    do {
+        waited = wait4(this->m_pid, &status, block ? 0 : WNOHANG, &usage);
+    } while (waited == -1 && errno == EINTR);
+    if (waited == 0) {
+        return false;
+    }
+    if (waited == -1) {
+        this->set_exit_status(SPAWN_STATUS_LOST, nullptr);
+    } else {
+        this->set_exit_status(status, &usage);
+    }
+    return true;
+}
+void Subprocess::set_exit_status(int status, const struct rusage* usage){
+    this->cancel_timers();
+    // Stop the clock at the exit, not when the output and log are drained
+    this->m_end_time = std::chrono::steady_clock::now();
+    this->m_duration = std::chrono::duration<double>(this->m_end_time - this->m_start_time).count();
+    if (usage != nullptr) {
+        this->m_usage.user_time = usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+        this->m_usage.system_time = usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+        this->m_usage.max_rss_kb = usage->ru_maxrss;
+        this->m_usage.minor_faults = usage->ru_minflt;
+        this->m_usage.major_faults = usage->ru_majflt;
+        this->m_usage.voluntary_switches = usage->ru_nvcsw;
+        this->m_usage.involuntary_switches = usage->ru_nivcsw;
+        this->m_usage.input_blocks = usage->ru_inblock;
+        this->m_usage.output_blocks = usage->ru_oublock;
+    }
+    if (status == SPAWN_STATUS_LOST) {
+        this->m_return_code = -2;
+        this->m_exit_reason = Exit_Lost;
+    } else if (WIFEXITED(status)) {
+        this->m_return_code = WEXITSTATUS(status);
+        this->m_exit_reason = Exit_Normal;
+    } else if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        this->m_return_code = 128 + sig;
+        this->m_exit_reason = Exit_Signal;
+        // The kernel kills with SIGXCPU at the soft CPU limit and SIGKILL at
+        // the hard one. An exhausted address space shows up as failed
+        // allocations, which usually end in abort() or a crash.
+        double cpu_time = this->m_usage.user_time + this->m_usage.system_time;
+        if (this->m_limits.cpu_time >= 0 && (sig == SIGXCPU || (sig == SIGKILL && cpu_time >= this->m_limits.cpu_time))) {
+            this->m_exit_reason = Exit_CpuLimit;
+        } else if (this->m_limits.address_space >= 0 && (sig == SIGABRT || sig == SIGSEGV || sig == SIGBUS || sig == SIGKILL)) {
+            this->m_exit_reason = Exit_MemoryLimit;
+        }
+    }
+    if (status != SPAWN_STATUS_LOST && this->m_stop_reason != Exit_None) {
+        this->m_exit_reason = this->m_stop_reason;
+    }
+    this->m_exited = true;
+}
+void Subprocess::arm_timers(){
+    Reactor& reactor = Reactor::instance();
+    this->m_last_output = this->m_start_time;
+    if (this->m_timeout > 0) {
+        auto deadline = this->m_start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(this->m_timeout));
+        this->m_timeout_timer = reactor.add_timer(deadline, [this](){
+            this->m_timeout_timer = 0;
+            this->stop(Exit_Timeout);
+        });
+    }
+    if (this->m_idle_timeout > 0 && (this->m_read_fd != -1 || this->m_error_fd != -1)) {
+        this->on_idle_timer();
+    }
+}
+void Subprocess::on_idle_timer(){
+    // One timer per process, re-armed from the last output when it fires,
+    // so output itself never touches the wheel
+    auto deadline = this->m_last_output + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(this->m_idle_timeout));
+    if (std::chrono::steady_clock::now() >= deadline) {
+        this->m_idle_timer = 0;
+        this->stop(Exit_IdleTimeout);
+        return;
+    }
+    this->m_idle_timer = Reactor::instance().add_timer(deadline, [this](){ this->on_idle_timer(); });
+}
+void Subprocess::stop(Exit_ reason){
+    if (this->m_exited || this->m_stop_reason != Exit_None) {
+        return;
+    }
+    this->m_stop_reason = reason;
+    this->send_signal(SIGTERM);
+    auto grace = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(this->m_kill_grace));
+    this->m_kill_timer = Reactor::instance().add_timer(std::chrono::steady_clock::now() + grace, [this](){
+        this->m_kill_timer = 0;
+        this->send_signal(SIGKILL);
+    });
+}
+void Subprocess::send_signal(int sig){
+    if (this->m_new_group) {
+        // the group outlives an unreaped leader, so its id cannot be reused
+        kill(-this->m_pid, sig);
+        return;
+    }
+#ifdef SYS_pidfd_send_signal
+    // a pidfd cannot hit a recycled pid
+    if (this->m_pidfd != -1 && syscall(SYS_pidfd_send_signal, this->m_pidfd, sig, nullptr, 0) == 0) {
+        return;
+    }
+#endif
+    kill(this->m_pid, sig);
+}
+void Subprocess::kill_process(){
+    if (this->m_pid == -1 || this->m_exited) {
+        return;
+    }
+    if (this->m_stop_reason == Exit_None) {
+        this->m_stop_reason = Exit_Terminated;
+    }
+    this->send_signal(SIGKILL);
+}
+void Subprocess::cancel_timers(){
+    Reactor& reactor = Reactor::instance();
+    uint64_t* timers[] = {&this->m_timeout_timer, &this->m_idle_timer, &this->m_kill_timer};
+    for (uint64_t* timer : timers) {
+        if (*timer != 0) {
+            reactor.cancel_timer(*timer);
+            *timer = 0;
+        }
+    }
+}
+void Subprocess::queue_stdin(std::string owned, const char* data, size_t size, std::function<void(bool)> on_done){
+    bool dropped;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        dropped = this->m_stdin_closing;
+        if(!dropped){
+            this->m_stdin_queue.push_back(StdinChunk{std::move(owned), data, size, std::move(on_done)});
+            StdinChunk& chunk = this->m_stdin_queue.back();
+            if(!chunk.owned.empty()){
+                // deque elements stay put, so the pointer is stable
+                chunk.data = chunk.owned.data();
+            }
+            this->post_stdin();
+        }
+    }
+    if(dropped && on_done){
+        on_done(false);
+    }
+}
+Subprocess* Subprocess::close_stdin(){
+    if(this->m_stdin.kind != Redirect_Pipe){
+        throw std::runtime_error("'" + this->m_command + "' has no stdin pipe");
+    }
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    if(!this->m_stdin_closing){
+        this->m_stdin_closing = true;
+        this->post_stdin();
+    }
+    return this;
+}
+void Subprocess::post_stdin(){
+    // one pending flush covers every write queued before it runs
+    if(this->m_stdin_posted){
+        return;
+    }
+    this->m_stdin_posted = true;
+    Reactor::instance().post([this](){ this->flush_stdin(); });
+}
+void Subprocess::flush_stdin(){
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_stdin_posted = false;
+    }
+    if(this->m_stdin_fd == -1){
+        return;
+    }
+    while(true){
+        StdinChunk* chunk = nullptr;
+        bool closing;
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            if(!this->m_stdin_queue.empty()){
+                chunk = &this->m_stdin_queue.front();
+            }
+            closing = this->m_stdin_closing;
+        }
+        if(chunk == nullptr){
+            // drained: stop waiting for room, and send EOF if asked to
+            if(this->m_stdin_token != 0){
+                Reactor::instance().remove(this->m_stdin_token);
+                this->m_stdin_token = 0;
+            }
+            if(closing){
+                close(this->m_stdin_fd);
+                this->m_stdin_fd = -1;
+            }
+            return;
+        }
+        // Only this thread pops, so the front chunk is written outside the lock
+        ssize_t count = 0;
+        if(chunk->size > 0){
+            count = WritePipe(this->m_stdin_fd, chunk->data, chunk->size);
+        }
+        if(count >= 0){
+            chunk->data += count;
+            chunk->size -= (size_t)count;
+            if(chunk->size == 0){
+                std::function<void(bool)> on_done = std::move(chunk->on_done);
+                {
+                    std::lock_guard<std::mutex> lock(this->m_mutex);
+                    this->m_stdin_queue.pop_front();
+                }
+                if(on_done){
+                    on_done(true);
+                }
+            }
+            continue;
+        }
+        if(errno == EINTR){
+            continue;
+        }
+        if(errno == EAGAIN){
+            // pipe full: carry on once the child has read some of it
+            if(this->m_stdin_token == 0){
+                this->m_stdin_token = Reactor::instance().add(this->m_stdin_fd, EPOLLOUT, [this](uint32_t){ this->flush_stdin(); });
+            }
+            return;
+        }
+        // EPIPE: the child closed its stdin
+        this->drop_stdin();
+        return;
+    }
+}
+void Subprocess::drop_stdin(){
+    std::deque<StdinChunk> dropped;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        dropped.swap(this->m_stdin_queue);
+        this->m_stdin_closing = true;
+    }
+    if(this->m_stdin_token != 0){
+        Reactor::instance().remove(this->m_stdin_token);
+        this->m_stdin_token = 0;
+    }
+    if(this->m_stdin_fd != -1){
+        close(this->m_stdin_fd);
+        this->m_stdin_fd = -1;
+    }
+    for(StdinChunk& chunk : dropped){
+        if(chunk.on_done){
+            chunk.on_done(false);
+        }
+    }
+}
+void Subprocess::try_complete(){
+    if (!this->m_pipe_closed || this->m_error_fd != -1) {
+        return;
+    }
+    if (this->m_exited) {
+        this->complete();
+    } else if (this->m_pidfd == -1 && this->p_spawn_server == nullptr) {
+        // No pidfd support (kernel < 5.3): poll for the exit on the reactor tick
+        Reactor::instance().poll([this](){
+            if (!this->reap(false)) {
+                return false;
+            }
+            this->complete();
+            return true;
+        });
+    }
+}
+#endif
 Subprocess* Subprocess::join(){
+#ifdef _WIN32
     if(this->p_monitor_thread != nullptr){
         if(this->p_monitor_thread->joinable()){
             this->p_monitor_thread->join();
         }
     }
+#endif
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    this->m_cv.wait(lock, [this](){
+        Subprocess_ state = this->m_state.load(std::memory_order_acquire);
+        return state != Subprocess_Started && state != Subprocess_InProgress;
+    });
+    return this;
+}
+Subprocess_ Subprocess::wait_for_state(Subprocess_ state){
+    // std::atomic::wait: a futex wait on the transition counter, so a failed
+    // start (NotStarted -> Started -> NotStarted) is seen even though the
+    // state ends where it began. NotStarted after any transition can only be
+    // such a rollback.
+    uint32_t seen = this->m_state_changes.load(std::memory_order_acquire);
+    while(true){
+        Subprocess_ current = this->m_state.load(std::memory_order_acquire);
+        if(current >= state || (current == Subprocess_NotStarted && seen != 0)){
+            return current;
+        }
+        this->m_state_changes.wait(seen, std::memory_order_acquire);
+        seen = this->m_state_changes.load(std::memory_order_acquire);
+    }
+}
+bool Subprocess::wait_until(Subprocess_ state, std::chrono::steady_clock::time_point deadline){
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    this->m_cv.wait_until(lock, deadline, [this, state](){
+        Subprocess_ current = this->m_state.load(std::memory_order_acquire);
+        return current >= state || (current == Subprocess_NotStarted && this->m_state_changes.load(std::memory_order_acquire) != 0);
+    });
+    return this->m_state.load(std::memory_order_acquire) >= state;
+}
+void Subprocess::commit_output(Stream_ stream, size_t size){
+    OutputBuffer& buffer = stream == Stream_Stdout ? this->m_output : this->m_error_output;
+    size_t begin = buffer.bytes_seen();
+    buffer.commit(size);
+    if(this->m_record_order){
+#ifdef _WIN32
+        // stdout and stderr have a reader thread each
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+#endif
+        size_t end = buffer.bytes_seen();
+        if(!this->m_output_order.empty() && this->m_output_order.back().stream == stream){
+            this->m_output_order.back().end = end;
+        }else if(end > begin){
+            this->m_output_order.push_back(OutputRecord{stream, begin, end});
+        }
+    }
+    this->deliver_output(stream, buffer);
+}
+void Subprocess::finish_output(Stream_ stream){
+    OutputBuffer& buffer = stream == Stream_Stdout ? this->m_output : this->m_error_output;
+    // the unterminated last line is complete now
+    buffer.finish();
+    this->deliver_output(stream, buffer);
+}
+void Subprocess::deliver_output(Stream_ stream, const OutputBuffer& buffer){
+    // Views straight into the arena: nothing is copied for the callbacks
+    if(this->m_on_chunk){
+        std::string_view data = buffer.recent();
+        if(!data.empty()){
+            this->m_on_chunk(stream, data);
+        }
+    }
+    if(this->m_on_line){
+        // one table per reader thread, reused across reads
+        thread_local std::vector<std::string_view> lines;
+        lines.clear();
+        buffer.recent_lines(lines);
+        for(std::string_view line : lines){
+            this->m_on_line(stream, line);
+        }
+    }
+}
+std::string Subprocess::merged_output() const{
+    // Walk each buffer's retained pieces once, copying the recorded ranges
+    // in arrival order; bytes no longer retained are skipped
+    const OutputBuffer* buffers[2] = {&this->m_output, &this->m_error_output};
+    std::vector<std::string_view> pieces[2] = {this->m_output.chunks(), this->m_error_output.chunks()};
+    size_t piece[2] = {0, 0};
+    size_t piece_begin[2] = {this->m_output.bytes_dropped(), this->m_error_output.bytes_dropped()};
+    size_t copied[2] = {0, 0};
+    std::string merged;
+    merged.reserve(this->m_output.size() + this->m_error_output.size());
+    auto copy = [&](int s, size_t begin, size_t end){
+        while(begin < end && piece[s] < pieces[s].size()){
+            std::string_view current = pieces[s][piece[s]];
+            size_t piece_end = piece_begin[s] + current.size();
+            if(begin >= piece_end){
+                piece_begin[s] = piece_end;
+                piece[s]++;
+                continue;
+            }
+            begin = std::max(begin, piece_begin[s]);
+            size_t take = std::min(end, piece_end) - begin;
+            merged.append(current.data() + (begin - piece_begin[s]), take);
+            begin += take;
+        }
+        copied[s] = std::max(copied[s], end);
+    };
+    for(const OutputRecord& record : this->m_output_order){
+        copy(record.stream == Stream_Stdout ? 0 : 1, record.begin, record.end);
+    }
+    // unrecorded text (all of it without m_record_order, or a held back
+    // '\r' that finish() released) goes last
+    for(int s = 0; s < 2; s++){
+        copy(s, copied[s], buffers[s]->bytes_seen());
+    }
+    return merged;
+}
+Subprocess* Subprocess::write_stdin(std::string data, std::function<void(bool written)> on_done){
+    if(this->m_stdin.kind != Redirect_Pipe){
+        throw std::runtime_error("'" + this->m_command + "' has no stdin pipe");
+    }
+    size_t size = data.size();
+    this->queue_stdin(std::move(data), nullptr, size, std::move(on_done));
+    return this;
+}
+Subprocess* Subprocess::write_stdin(const char* data, size_t size, std::function<void(bool written)> on_done){
+    if(this->m_stdin.kind != Redirect_Pipe){
+        throw std::runtime_error("'" + this->m_command + "' has no stdin pipe");
+    }
+    this->queue_stdin(std::string(), data, size, std::move(on_done));
     return this;
 }
 Subprocess* Subprocess::terminate(){
+    bool running;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        running = this->m_state == Subprocess_Started || this->m_state == Subprocess_InProgress;
+    }
+    if(running){
+#ifdef _WIN32
+        this->kill_process();
+#else
+        // on the loop thread, where the exit is reaped: a reaped pid is
+        // never signalled
+        Reactor::instance().call([this](){ this->kill_process(); });
+#endif
+    }
     this->join();
+#ifdef _WIN32
     if(this->p_monitor_thread != nullptr){
         delete this->p_monitor_thread;
         this->p_monitor_thread = nullptr;
     }
-    this->m_state = Subprocess_Terminated;
+#endif
+    this->set_state(Subprocess_Terminated);
     return this;
 }
+void SubprocessManager::start_spawn_server(){
+#ifndef _WIN32
+    SpawnServer::start();
+#endif
+}
 SubprocessManager::SubprocessManager(){
     this->m_state = Subprocess_NotStarted;
-    this->p_monitor_thread = NULL;
+    this->m_remaining = 0;
+    this->m_running = 0;
+    this->m_max_running = std::thread::hardware_concurrency();
+    if(this->m_max_running == 0){
+        this->m_max_running = 1;
+    }
+    this->m_schedule = Schedule_CriticalPath;
+    this->m_makespan = 0.0;
+    this->m_placement = Placement_None;
+    this->m_next_target = 0;
+    this->m_terminating = false;
+    this->m_starting = 0;
     this->m_processes = {};
 }
 SubprocessManager::~SubprocessManager(){
+    this->terminate();
     for(Subprocess *process:this->m_processes){
         delete process;
     }
-    this->terminate();
 }
 int SubprocessManager::find(std::string name){
+    auto found = this->m_index.find(name);
+    if(found != this->m_index.end() && found->second < this->m_processes.size() && this->m_processes[found->second]->m_name == name){
+        return (int)found->second;
+    }
+    // a miss on an index that covers every process is final, so add() stays
+    // O(1) on large managers
+    if(found == this->m_index.end() && this->m_index.size() == this->m_processes.size()){
+        return -1;
+    }
+    // m_processes or a name was changed directly: rebuild the index
+    this->m_index.clear();
+    int found_idx = -1;
     for(int i=0;i<this->m_processes.size();i++){
-        if(this->m_processes[i]->m_name == name){
-            return i;
+        this->m_index.emplace(this->m_processes[i]->m_name, i);
+        if(found_idx == -1 && this->m_processes[i]->m_name == name){
+            found_idx = i;
         }
     }
-    return -1;
+    return found_idx;
 }
 SubprocessManager* SubprocessManager::add(Subprocess* process)
 {
@@ -230,79 +1716,403 @@ SubprocessManager* SubprocessManager::add(Subprocess* process)
         throw std::runtime_error("Given process is 'NULL'");
     }
     if(this->find(process->m_name) != -1){
-        throw std::runtime_error(std::format("Duplicate task found('{0}')",process->m_name));
+        throw std::runtime_error("Duplicate task found('" + process->m_name + "')");
     }
+    this->m_index[process->m_name] = this->m_processes.size();
     this->m_processes.push_back(process);
     return this;
 }
-SubprocessManager* SubprocessManager::add(std::string name, std::string command, std::string curr_directory, std::string log_path,std::map<std::string,std::string> env_var)
+SubprocessManager* SubprocessManager::add(std::string name, std::string command, std::string curr_directory, std::string log_path,std::map<std::string,std::string> env_var,
+                                          Redirect stdin_redirect, Redirect stdout_redirect, Redirect stderr_redirect,
+                                          ResourceLimits limits)
 {
     if(this->find(name) != -1){
-        throw std::runtime_error(std::format("Duplicate task found('{0}')",name));
+        throw std::runtime_error("Duplicate task found('" + name + "')");
     }
-    
-    this->m_processes.push_back(new Subprocess(name,command,curr_directory,log_path,env_var));
+
+    this->m_index[name] = this->m_processes.size();
+    this->m_processes.push_back(new Subprocess(name,command,curr_directory,log_path,env_var,stdin_redirect,stdout_redirect,stderr_redirect,limits));
+    return this;
+}
+SubprocessManager* SubprocessManager::depends_on(std::string name, std::vector<std::string> dependencies){
+    Subprocess* process = (*this)[name];
+    process->m_depends_on.insert(process->m_depends_on.end(), dependencies.begin(), dependencies.end());
     return this;
 }
 Subprocess* SubprocessManager::operator[](std::string name){
     int found_idx = this->find(name);
     if( found_idx == -1){
-        throw std::runtime_error(std::format("Task '{0}' not found in the manager",name));
+        throw std::runtime_error("Task '" + name + "' not found in the manager");
     }
     return this->m_processes[found_idx];
 }
 SubprocessManager* SubprocessManager::start(){
     this->execute();
-    this->monitor();
+    this->join();
     return this;
 }
 SubprocessManager* SubprocessManager::start_async(){
     this->execute();
-    this->p_monitor_thread = new std::thread(std::bind(&SubprocessManager::monitor, this));
     return this;
 }
 void SubprocessManager::execute(){
-    if(this->m_state != Subprocess_NotStarted){
-        throw std::runtime_error("Manager already started");
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        if(this->m_state != Subprocess_NotStarted){
+            throw std::runtime_error("Manager already started");
+        }
     }
-    this->m_state = Subprocess_Started;
-    for(Subprocess *process:this->m_processes){
-        process->start_async();
+    // unknown dependencies and cycles are reported before anything starts
+    this->build_graph();
+    this->m_targets.clear();
+    if(this->m_placement == Placement_Cores){
+        this->m_targets = allowed_cpus();
+    }else if(this->m_placement == Placement_Nodes){
+        this->m_targets = numa_nodes();
+    }
+    this->m_target_load.assign(this->m_targets.size(), 0);
+    this->m_next_target = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->set_state(Subprocess_Started);
+        this->m_remaining = this->m_processes.size();
+        this->m_running = 0;
+        this->m_makespan = 0.0;
+        this->m_terminating = false;
+        this->m_usage = ResourceUsage();
+        this->m_start = Clock::now();
+        for(size_t i = 0; i < this->m_processes.size(); i++){
+            this->m_processes[i]->m_error = "";
+            if(this->m_tasks.waiting[i] == 0){
+                this->enqueue(i);
+            }
+        }
+        if(this->m_remaining == 0){
+            this->set_state(Subprocess_Completed);
+            return;
+        }
     }
-    this->m_state = Subprocess_InProgress;
+    this->schedule({});
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    if(this->m_state == Subprocess_Started){
+        this->set_state(Subprocess_InProgress);
+    }
+}
+void SubprocessManager::set_state(Subprocess_ state){
+    this->m_state.store(state, std::memory_order_release);
+    this->m_state.notify_all();
+    this->m_cv.notify_all();
+}
+void SubprocessManager::TaskTable::assign(size_t count){
+    this->state.assign(count, Subprocess_NotStarted);
+    this->return_code.assign(count, -1);
+    this->process_id.assign(count, -1);
+    this->skipped.assign(count, 0);
+    this->waiting.assign(count, 0);
+    this->target.assign(count, -1);
+    this->priority.assign(count, 0.0);
+    this->dependents_begin.assign(count + 1, 0);
+    this->dependents.clear();
 }
-void SubprocessManager::monitor(){
-    while(this->m_state == Subprocess_InProgress){
-        bool _all_done = true;    
-        for(Subprocess *process:this->m_processes){
-            if(process->m_state != Subprocess_Completed){
-                _all_done = false;
+void SubprocessManager::enqueue(size_t index){
+    this->m_ready.push(Ready{this->m_tasks.priority[index], index});
+}
+void SubprocessManager::place(size_t index){
+    Subprocess* process = this->m_processes[index];
+    if(this->m_targets.empty() || !process->m_cpus.empty() || process->m_numa_node != -1){
+        return;
+    }
+    // round-robin, skipping ahead to a target with fewer running processes
+    size_t count = this->m_targets.size();
+    size_t best = this->m_next_target % count;
+    for(size_t step = 1; step < count; step++){
+        size_t candidate = (this->m_next_target + step) % count;
+        if(this->m_target_load[candidate] < this->m_target_load[best]){
+            best = candidate;
+        }
+    }
+    this->m_target_load[best]++;
+    this->m_next_target = best + 1;
+    this->m_tasks.target[index] = (int)best;
+    if(this->m_placement == Placement_Cores){
+        process->m_cpus = {this->m_targets[best]};
+    }else{
+        process->m_numa_node = this->m_targets[best];
+    }
+}
+void SubprocessManager::build_graph(){
+    size_t count = this->m_processes.size();
+    TaskTable tasks;
+    tasks.assign(count);
+    // (dependency, dependent) pairs, then grouped by dependency
+    std::vector<std::pair<uint32_t,uint32_t>> edges;
+    for(size_t i = 0; i < count; i++){
+        for(const std::string& name : this->m_processes[i]->m_depends_on){
+            int found = this->find(name);
+            if(found == -1){
+                throw std::runtime_error("Task '" + this->m_processes[i]->m_name + "' depends on unknown task '" + name + "'");
             }
+            edges.emplace_back((uint32_t)found, (uint32_t)i);
+            tasks.dependents_begin[found + 1]++;
+            tasks.waiting[i]++;
         }
-        if(_all_done){
-            break;
+    }
+    for(size_t i = 0; i < count; i++){
+        tasks.dependents_begin[i + 1] += tasks.dependents_begin[i];
+    }
+    tasks.dependents.resize(edges.size());
+    std::vector<uint32_t> fill(tasks.dependents_begin.begin(), tasks.dependents_begin.end() - 1);
+    for(const auto& edge : edges){
+        tasks.dependents[fill[edge.first]++] = edge.second;
+    }
+    // Topological order (Kahn); whatever stays unordered is on a cycle
+    std::vector<size_t> order;
+    std::vector<size_t> waiting(tasks.waiting.begin(), tasks.waiting.end());
+    for(size_t i = 0; i < count; i++){
+        if(waiting[i] == 0){
+            order.push_back(i);
         }
-        Sleep(100); 
     }
-    this->m_state = Subprocess_Completed;
+    for(size_t next = 0; next < order.size(); next++){
+        size_t task = order[next];
+        for(uint32_t edge = tasks.dependents_begin[task]; edge < tasks.dependents_begin[task + 1]; edge++){
+            if(--waiting[tasks.dependents[edge]] == 0){
+                order.push_back(tasks.dependents[edge]);
+            }
+        }
+    }
+    if(order.size() != count){
+        // every unordered process waits on another unordered one: follow
+        // those edges until a process repeats
+        size_t current = 0;
+        while(waiting[current] == 0){
+            current++;
+        }
+        std::vector<size_t> path;
+        std::vector<size_t> seen(count, count);
+        while(seen[current] == count){
+            seen[current] = path.size();
+            path.push_back(current);
+            for(const std::string& name : this->m_processes[current]->m_depends_on){
+                size_t dependency = (size_t)this->find(name);
+                if(waiting[dependency] != 0){
+                    current = dependency;
+                    break;
+                }
+            }
+        }
+        std::string cycle;
+        for(size_t i = seen[current]; i < path.size(); i++){
+            cycle += this->m_processes[path[i]]->m_name + " -> ";
+        }
+        throw std::runtime_error("Dependency cycle: " + cycle + this->m_processes[current]->m_name);
+    }
+    if(this->m_schedule == Schedule_Priority){
+        for(size_t i = 0; i < count; i++){
+            tasks.priority[i] = this->m_processes[i]->m_priority;
+        }
+    }else if(this->m_schedule == Schedule_CriticalPath){
+        // Longest remaining path, dependents first
+        for(size_t i = count; i-- > 0;){
+            size_t task = order[i];
+            double longest = 0.0;
+            for(uint32_t edge = tasks.dependents_begin[task]; edge < tasks.dependents_begin[task + 1]; edge++){
+                longest = std::max(longest, tasks.priority[tasks.dependents[edge]]);
+            }
+            tasks.priority[task] = this->m_processes[task]->m_estimate + longest;
+        }
+    }
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    std::swap(this->m_tasks, tasks);
 }
-SubprocessManager* SubprocessManager::join(){
-    for(Subprocess *process:this->m_processes){
-        process->join();
+void SubprocessManager::schedule(std::vector<size_t> completed){
+    // Runs on the thread that completed a process (and once from execute()),
+    // so freed slots and unblocked dependents are started without polling.
+    // Once the last process is done a waiter may destroy the manager:
+    // nothing is touched after the final release. Claimed processes are
+    // started outside the lock, and m_starting holds the run open until this
+    // pass has taken the lock again, since they may complete right away.
+    TaskTable& tasks = this->m_tasks;
+    std::vector<size_t> finished;
+    std::vector<size_t> not_started;
+    std::vector<size_t> claimed;
+    while(true){
+        Clock::time_point queued;
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            if(!claimed.empty()){
+                // the last pass is done starting (failures are in not_started)
+                claimed.clear();
+                this->m_starting--;
+                if(this->m_starting == 0){
+                    this->m_cv.notify_all();
+                }
+            }
+            for(size_t index : completed){
+                Subprocess* process = this->m_processes[index];
+                tasks.state[index] = Subprocess_Completed;
+                tasks.return_code[index] = process->m_return_code;
+                tasks.process_id[index] = process->m_process_id;
+                this->m_usage.add(process->m_usage);
+                finished.push_back(index);
+            }
+            completed.clear();
+            for(size_t index : not_started){
+                tasks.state[index] = Subprocess_NotStarted;
+                finished.push_back(index);
+            }
+            not_started.clear();
+            // A failed process (non-zero exit or not started) takes all of
+            // its dependents down with it; they finish without a slot
+            for(size_t next = 0; next < finished.size(); next++){
+                size_t index = finished[next];
+                if(!tasks.skipped[index]){
+                    this->m_running--;
+                }
+                if(tasks.target[index] != -1){
+                    this->m_target_load[tasks.target[index]]--;
+                }
+                this->m_remaining--;
+                bool failed = tasks.skipped[index] || tasks.return_code[index] != 0;
+                for(uint32_t edge = tasks.dependents_begin[index]; edge < tasks.dependents_begin[index + 1]; edge++){
+                    uint32_t dependent = tasks.dependents[edge];
+                    if(tasks.skipped[dependent]){
+                        continue;
+                    }
+                    if(failed){
+                        tasks.skipped[dependent] = 1;
+                        this->m_processes[dependent]->m_error = "Dependency '" + this->m_processes[index]->m_name + "' failed";
+                        finished.push_back(dependent);
+                    }else if(--tasks.waiting[dependent] == 0){
+                        this->enqueue(dependent);
+                    }
+                }
+            }
+            finished.clear();
+            if(this->m_remaining == 0 && this->m_starting == 0){
+                this->m_makespan = std::chrono::duration<double>(Clock::now() - this->m_start).count();
+                this->set_state(Subprocess_Completed);
+                return;
+            }
+            claimed.clear();
+            while(this->m_terminating && !this->m_ready.empty()){
+                // terminate(): released with the next pass without running
+                size_t index = this->m_ready.top().index;
+                this->m_ready.pop();
+                tasks.skipped[index] = 1;
+                this->m_processes[index]->m_error = "Terminated";
+                finished.push_back(index);
+            }
+            while(!this->m_ready.empty() && (this->m_max_running == 0 || this->m_running < this->m_max_running)){
+                size_t index = this->m_ready.top().index;
+                claimed.push_back(index);
+                this->m_ready.pop();
+                this->m_running++;
+                tasks.state[index] = Subprocess_InProgress;
+                this->place(index);
+            }
+            if(!claimed.empty()){
+                // terminate() waits for this pass before its kill pass
+                this->m_starting++;
+            }
+            queued = this->m_start;
+        }
+        for(size_t index : claimed){
+            Subprocess* process = this->m_processes[index];
+            Clock::time_point started = Clock::now();
+            process->m_queue_wait = std::chrono::duration<double>(started - queued).count();
+            process->m_dequeued = started;
+            // completion is pushed by each process instead of polled
+            process->m_on_complete = [this, index](){
+                this->schedule({index});
+            };
+            try{
+                process->start_async();
+            }catch(std::exception& error){
+                // it never runs: released with the next pass
+                process->m_error = error.what();
+                process->m_on_complete = nullptr;
+                not_started.push_back(index);
+            }
+        }
+        if(finished.empty() && not_started.empty() && claimed.empty()){
+            return;
+        }
     }
-    if(this->p_monitor_thread != nullptr){
-        if(this->p_monitor_thread->joinable()){
-            this->p_monitor_thread->join();
+}
+size_t SubprocessManager::count(Subprocess_ state){
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    size_t found = 0;
+    for(uint8_t task : this->m_tasks.state){
+        found += task == state;
+    }
+    return found;
+}
+std::vector<size_t> SubprocessManager::failed(){
+    // Only tasks that are done: a skipped one is done as soon as it is marked,
+    // a task that could not be started shares NotStarted with the queued ones
+    // until the run is over, and running ones have no return code yet
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    std::vector<size_t> found;
+    const TaskTable& tasks = this->m_tasks;
+    bool over = this->m_remaining == 0;
+    for(size_t i = 0; i < tasks.state.size(); i++){
+        if(tasks.state[i] == Subprocess_Completed){
+            if(tasks.return_code[i] != 0){
+                found.push_back(i);
+            }
+        }else if(tasks.skipped[i] || (over && tasks.state[i] == Subprocess_NotStarted)){
+            found.push_back(i);
         }
     }
+    return found;
+}
+SubprocessManager* SubprocessManager::join(){
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    this->m_cv.wait(lock, [this](){ return this->m_remaining == 0 && this->m_starting == 0; });
     return this;
 }
+Subprocess_ SubprocessManager::wait_for_state(Subprocess_ state){
+    Subprocess_ current = this->m_state.load(std::memory_order_acquire);
+    while(current < state){
+        this->m_state.wait(current, std::memory_order_acquire);
+        current = this->m_state.load(std::memory_order_acquire);
+    }
+    return current;
+}
+bool SubprocessManager::wait_until(Subprocess_ state, std::chrono::steady_clock::time_point deadline){
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    return this->m_cv.wait_until(lock, deadline, [this, state](){
+        return this->m_state.load(std::memory_order_acquire) >= state;
+    });
+}
 SubprocessManager* SubprocessManager::terminate(){
-    this->join();
-    if(this->p_monitor_thread != nullptr){
-        delete this->p_monitor_thread;
-        this->p_monitor_thread = nullptr;
+    bool running;
+    {
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        running = this->m_remaining != 0;
+        this->m_terminating = running;
+        // processes claimed before this are started outside the lock: once
+        // those passes are done no more start, and the kill pass sees them all
+        this->m_cv.wait(lock, [this](){ return this->m_starting == 0; });
     }
-    this->m_state = Subprocess_Terminated;
+    if(running){
+        // queued processes are dropped, the running ones killed in one pass
+        this->schedule({});
+#ifdef _WIN32
+        for(Subprocess* process : this->m_processes){
+            process->kill_process();
+        }
+#else
+        Reactor::instance().call([this](){
+            for(Subprocess* process : this->m_processes){
+                process->kill_process();
+            }
+        });
+#endif
+    }
+    this->join();
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    this->set_state(Subprocess_Terminated);
     return this;
-}
\ No newline at end of file
+}
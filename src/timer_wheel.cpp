@@ -0,0 +1,128 @@
+#include "timer_wheel.h"
+using namespace subprocess_manager;
+
+TimerWheel::TimerWheel(){
+    this->m_origin = Clock::now();
+    this->m_now = 0;
+    this->m_next_id = 1;
+}
+uint64_t TimerWheel::to_tick(Clock::time_point when) const{
+    if(when <= this->m_origin){
+        return 0;
+    }
+    // round up so a timer never fires before its deadline
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(when - this->m_origin).count();
+    return (uint64_t)(elapsed + 999) / 1000;
+}
+uint64_t TimerWheel::add(Clock::time_point when, Callback callback){
+    uint64_t id = this->m_next_id++;
+    uint64_t tick = this->to_tick(when);
+    this->m_timers[id] = Timer{tick, std::move(callback)};
+    this->file(id, tick);
+    return id;
+}
+void TimerWheel::cancel(uint64_t id){
+    // the id stays in its slot and is skipped when the slot comes up
+    this->m_timers.erase(id);
+}
+size_t TimerWheel::size() const{
+    return this->m_timers.size();
+}
+void TimerWheel::file(uint64_t id, uint64_t tick){
+    // due now or overdue: the next tick
+    if(tick <= this->m_now){
+        tick = this->m_now + 1;
+    }
+    // beyond the top level: park it at the far end, it is re-filed on the way
+    const uint64_t horizon = (uint64_t)1 << (SLOT_BITS * LEVELS);
+    if(tick - this->m_now >= horizon){
+        tick = this->m_now + horizon - 1;
+    }
+    uint64_t delta = tick - this->m_now;
+    int level = 0;
+    while(level < LEVELS - 1 && delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))){
+        level++;
+    }
+    this->m_slots[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(id);
+}
+void TimerWheel::cascade(int level){
+    std::vector<uint64_t> ids;
+    ids.swap(this->m_slots[level][(this->m_now >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+    for(uint64_t id : ids){
+        auto found = this->m_timers.find(id);
+        if(found != this->m_timers.end()){
+            this->file(id, found->second.tick);
+        }
+    }
+}
+void TimerWheel::advance(Clock::time_point now, std::vector<std::pair<uint64_t,Callback>>& expired){
+    if(now <= this->m_origin){
+        return;
+    }
+    uint64_t target = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(now - this->m_origin).count();
+    if(this->m_timers.empty()){
+        // nothing to expire: jump, dropping the ids of cancelled timers
+        if(target > this->m_now){
+            for(auto& level : this->m_slots){
+                for(auto& slot : level){
+                    slot.clear();
+                }
+            }
+            this->m_now = target;
+        }
+        return;
+    }
+    while(this->m_now < target){
+        this->m_now++;
+        // at a slot boundary of level n the current slot of every level up
+        // to n is re-filed, coarsest first
+        int top = 0;
+        while(top < LEVELS - 1 && (this->m_now & (((uint64_t)1 << (SLOT_BITS * (top + 1))) - 1)) == 0){
+            top++;
+        }
+        for(int level = top; level > 0; level--){
+            this->cascade(level);
+        }
+        std::vector<uint64_t>& slot = this->m_slots[0][this->m_now & (SLOTS - 1)];
+        if(slot.empty()){
+            continue;
+        }
+        std::vector<uint64_t> ids;
+        ids.swap(slot);
+        for(uint64_t id : ids){
+            auto found = this->m_timers.find(id);
+            if(found == this->m_timers.end()){
+                continue;
+            }
+            if(found->second.tick > this->m_now){
+                this->file(id, found->second.tick);
+                continue;
+            }
+            expired.emplace_back(id, std::move(found->second.callback));
+            this->m_timers.erase(found);
+        }
+    }
+}
+int TimerWheel::next_timeout_ms(Clock::time_point now) const{
+    if(this->m_timers.empty()){
+        return -1;
+    }
+    int64_t current = now <= this->m_origin ? 0 : std::chrono::duration_cast<std::chrono::milliseconds>(now - this->m_origin).count();
+    // the next live slot of the finest level, or the next cascade that may
+    // bring timers down into it
+    uint64_t tick = this->m_now + 1;
+    for(; (tick & (SLOTS - 1)) != 0; tick++){
+        bool live = false;
+        for(uint64_t id : this->m_slots[0][tick & (SLOTS - 1)]){
+            if(this->m_timers.count(id) != 0){
+                live = true;
+                break;
+            }
+        }
+        if(live){
+            break;
+        }
+    }
+    int64_t wait = (int64_t)tick - current;
+    return wait > 0 ? (int)wait : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMER_WHEEL_H              // Include guard to prevent multiple definitions
+#define TIMER_WHEEL_H
+#include <chrono>               // For deadlines
+#include <cstdint>              // For fixed width integers
+#include <functional>           // For timer callbacks
+#include <unordered_map>        // For the pending timers by id
+#include <utility>              // For expired (id, callback) pairs
+#include <vector>               // For the wheel slots
+namespace subprocess_manager {
+    // Hierarchical timing wheel with a 1 ms tick: four levels of 256 slots
+    // cover 2^32 ms (later deadlines are re-filed as the wheel turns).
+    // Adding and cancelling are O(1); each timer is moved down at most once
+    // per level before it expires, so tens of thousands of per-process
+    // timeouts cost no more than a handful. Not thread safe: the owner
+    // serialises access.
+    class TimerWheel {
+        public:
+            using Clock = std::chrono::steady_clock;
+            using Callback = std::function<void()>;
+            uint64_t                                    add(Clock::time_point when, Callback callback); // Schedule, returns an id (never 0)
+            void                                        cancel(uint64_t id); // Drop a pending timer (no-op once expired)
+            void                                        advance(Clock::time_point now, std::vector<std::pair<uint64_t,Callback>>& expired); // Move the timers due by now into expired
+            int                                         next_timeout_ms(Clock::time_point now) const; // Upper bound on the wait for the next timer, -1 if none
+            size_t                                      size() const;       // Pending timers
+            TimerWheel();                                                   // Constructor
+        private:
+            static const int                            LEVELS = 4;         // Wheels, each 256 times coarser than the last
+            static const int                            SLOT_BITS = 8;      // log2 of the slots per level
+            static const uint64_t                       SLOTS = 1 << SLOT_BITS; // Slots per level
+            struct Timer {
+                uint64_t                                tick;               // Expiry, in ticks since m_origin
+                Callback                                callback;           // Run on expiry
+            };
+            Clock::time_point                           m_origin;           // Tick 0
+            uint64_t                                    m_now;              // Last tick processed
+            uint64_t                                    m_next_id;          // Next timer id
+            std::unordered_map<uint64_t,Timer>          m_timers;           // Pending timers by id (cancel erases here only)
+            std::vector<uint64_t>                       m_slots[LEVELS][SLOTS]; // Ids per slot, may hold cancelled ids
+            uint64_t                                    to_tick(Clock::time_point when) const; // Round up to a tick
+            void                                        file(uint64_t id, uint64_t tick); // Put id in the slot for tick
+            void                                        cascade(int level); // Re-file the current slot of level one level down
+    };
+}
+#endif // TIMER_WHEEL_H
@@ -1,7 +1,6 @@
 #include <iostream>
 #include <chrono>
-#include <format>
-#include <windows.h>
+#include <thread>
 
 using namespace std;
 
@@ -34,11 +33,11 @@ int main(int argc, char** argv)
     int sleep_time  = atoi(argv[2]);
     int exit_code   = atoi(argv[3]);
     for(int i=0;i<atoi(argv[1]);i++){
-        cout << "Output:" << std::format("{0:%F_%T}",std::chrono::system_clock::now()) << endl;        
-        Sleep(sleep_time);
+        cout << "Output:" << get_time() << endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time));
     }
     if(exit_code != 0){
-        cerr << "Error :" << std::format("{0:%F_%T}",std::chrono::system_clock::now());
+        cerr << "Error :" << get_time();
         return exit_code;
     }
     return 0;
@@ -0,0 +1,2 @@
+#!/bin/sh
+echo $ENV1_VAR
@@ -0,0 +1,3 @@
+#!/bin/sh
+echo $ENV1_VAR
+echo $ENV2_VAR
@@ -1,33 +1,57 @@
 #include <stdexcept>
 #include <subprocess_manager.h>
-#include <format>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <csignal>
+#include "affinity.h"
+#include "environment.h"
+#include "line_scanner.h"
+#include "timer_wheel.h"
 #include "utest.h"
 using namespace std;
 using namespace subprocess_manager;
 
+#ifdef _WIN32
+#define TASK            "task.exe"
+#define TEST_DIR        "..\\test\\"
+#define TEST_ENV_1      "..\\test\\test_env_1.bat"
+#define NEWLINE         "\r\n"
+#else
+#define TASK            "./task"
+#define TEST_DIR        "../test/"
+#define TEST_ENV_1      "sh test_env_1.sh"
+#define NEWLINE         "\n"
+#endif
+
 UTEST(Subprocess, SingleProcess)
 {
     // happy test case
-    Subprocess *process1 = new Subprocess("process1","task.exe 2 100 1");
+    Subprocess *process1 = new Subprocess("process1",TASK " 2 100 1");
     process1->start_async()->join();
     // while(process1->m_state != Subprocess_Completed);
     EXPECT_EQ(1, process1->m_return_code);
     delete process1;
     // different directory
-    Subprocess *diff_dir = new Subprocess("diff_dir","task.exe 2 100 1","..\\test");
+    std::string task_path = std::filesystem::absolute(TASK).string();
+    Subprocess *diff_dir = new Subprocess("diff_dir",task_path + " 2 100 1",TEST_DIR);
     diff_dir->start();
     EXPECT_EQ(1, diff_dir->m_return_code);
     // log path
-    Subprocess *log_path = new Subprocess("log_path","task.exe 2 100 1","","log.txt");
+    Subprocess *log_path = new Subprocess("log_path",TASK " 2 100 1","","log.txt");
     log_path->start();
     EXPECT_EQ(1, log_path->m_return_code);
     EXPECT_TRUE(std::filesystem::exists("log.txt"));
     // env path
-    Subprocess *env_path = new Subprocess("env_path","..\\test\\test_env_1.bat","..\\test\\","",{{"ENV1_VAR","ENV1_Value"}});
+    Subprocess *env_path = new Subprocess("env_path",TEST_ENV_1,TEST_DIR,"",{{"ENV1_VAR","ENV1_Value"}});
     EXPECT_EQ(env_path->start()->m_return_code, 0);
-    EXPECT_STREQ(env_path->m_output_str.c_str(),"ENV1_Value\r\n");
+    std::string env_output = env_path->m_output.str();
+    EXPECT_STREQ(env_output.c_str(),"ENV1_Value" NEWLINE);
     // invalid process
     Subprocess *invalid = new Subprocess("invalid","invalid 1 2 3");
     EXPECT_EXCEPTION({invalid->start_async();}, std::runtime_error);
@@ -37,29 +61,864 @@ UTEST(Subprocess, SingleProcess)
 
 UTEST(Subprocess, Multiprocess)
 {
-    Subprocess *process1 = new Subprocess("process1","task.exe 2 100 1");
-    Subprocess *process2 = new Subprocess("process2","task.exe 4 100 2");
+    Subprocess *process1 = new Subprocess("process1",TASK " 2 100 1");
+    Subprocess *process2 = new Subprocess("process2",TASK " 4 100 2");
     process1->start_async();
     process2->start_async();
-    while(true){
-        if(process1->m_state == Subprocess_Completed && process2->m_state == Subprocess_Completed){
-            break;
-        }
-        // Sleep(100);
-    }
+    EXPECT_EQ(Subprocess_Completed, process1->wait_for_state(Subprocess_Completed));
+    EXPECT_EQ(Subprocess_Completed, process2->wait_for_state(Subprocess_Completed));
     EXPECT_EQ(1, process1->m_return_code);
     EXPECT_EQ(2, process2->m_return_code);
     delete process1;
     delete process2;
 }
+UTEST(Subprocess, WaitForState)
+{
+    using namespace std::chrono;
+    Subprocess process("process",TASK " 3 100 4");
+    // never started: only a deadline ends the wait
+    EXPECT_FALSE(process.wait_until(Subprocess_Started, steady_clock::now() + milliseconds(10)));
+    process.start_async();
+    EXPECT_TRUE(process.wait_for_state(Subprocess_Started) >= Subprocess_Started);
+    EXPECT_FALSE(process.wait_until(Subprocess_Completed, steady_clock::now() + milliseconds(10)));
+    EXPECT_EQ(Subprocess_Completed, process.wait_for_state(Subprocess_Completed));
+    EXPECT_EQ(4, process.m_return_code);
+    // a later state satisfies an earlier one
+    EXPECT_EQ(Subprocess_Completed, process.wait_for_state(Subprocess_Started));
+    EXPECT_TRUE(process.wait_until(Subprocess_Completed, steady_clock::now()));
+    process.terminate();
+    EXPECT_EQ(Subprocess_Terminated, process.wait_for_state(Subprocess_Completed));
+    // every waiter is woken by the one transition
+    Subprocess shared("shared",TASK " 2 100 0");
+    std::atomic<int> woken(0);
+    std::vector<std::thread> waiters;
+    for(int i = 0; i < 4; i++){
+        waiters.emplace_back([&shared, &woken](){
+            if(shared.wait_for_state(Subprocess_Completed) == Subprocess_Completed){
+                woken++;
+            }
+        });
+    }
+    shared.start_async();
+    for(std::thread& waiter : waiters){
+        waiter.join();
+    }
+    EXPECT_EQ(4, woken.load());
+    EXPECT_EQ(0, shared.m_return_code);
+    // a failed spawn rolls back to NotStarted and wakes everyone waiting
+    Subprocess invalid("invalid","invalid 1 2 3");
+    std::atomic<int> rolled_back(0);
+    std::thread waiter([&invalid, &rolled_back](){
+        if(invalid.wait_for_state(Subprocess_Completed) == Subprocess_NotStarted){
+            rolled_back++;
+        }
+    });
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_EXCEPTION({invalid.start_async();}, std::runtime_error);
+    waiter.join();
+    EXPECT_EQ(1, rolled_back.load());
+    EXPECT_EQ(Subprocess_NotStarted, invalid.wait_for_state(Subprocess_Completed));
+    EXPECT_FALSE(invalid.wait_until(Subprocess_Completed, steady_clock::now() + seconds(10)));
+    EXPECT_TRUE(steady_clock::now() - invalid.m_start_time < seconds(5));
+    invalid.join();
+    // the manager
+    SubprocessManager manager;
+    manager.add("process1",TASK " 2 100 1");
+    manager.add("process2",TASK " 3 100 2");
+    EXPECT_FALSE(manager.wait_until(Subprocess_Completed, steady_clock::now() + milliseconds(10)));
+    manager.start_async();
+    EXPECT_EQ(Subprocess_Completed, manager.wait_for_state(Subprocess_Completed));
+    EXPECT_EQ(1, manager["process1"]->m_return_code);
+    EXPECT_EQ(2, manager["process2"]->m_return_code);
+    EXPECT_TRUE(manager.wait_until(Subprocess_Completed, steady_clock::now()));
+}
+UTEST(Subprocess, Future)
+{
+    Subprocess process1("process1",TASK " 2 100 1");
+    Subprocess process2("process2",TASK " 3 100 2");
+    std::future<RunResult> result1 = process1.start_future();
+    std::future<RunResult> result2 = process2.start_future();
+    RunResult done2 = result2.get();
+    RunResult done1 = result1.get();
+    EXPECT_TRUE(done1.process == &process1);
+    EXPECT_EQ(1, done1.return_code);
+    EXPECT_EQ(Exit_Normal, done1.exit_reason);
+    EXPECT_TRUE(done1.duration > 0.0);
+    EXPECT_TRUE(done2.process == &process2);
+    EXPECT_EQ(2, done2.return_code);
+    // terminated: the future is ready all the same
+    Subprocess killed("killed",TASK " 100 100 0");
+    std::future<RunResult> result = killed.start_future();
+    killed.terminate();
+    EXPECT_EQ(Exit_Terminated, result.get().exit_reason);
+    // a process that cannot start throws right away
+    Subprocess invalid("invalid","invalid 1 2 3");
+    EXPECT_EXCEPTION({invalid.start_future();}, std::runtime_error);
+}
+// Minimal fire-and-forget coroutine type for the tests
+struct Detached {
+    struct promise_type {
+        Detached get_return_object(){ return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ std::terminate(); }
+    };
+};
+static Detached run_in_order(std::vector<Subprocess*> processes, std::vector<RunResult>* results, std::atomic<int>* done){
+    for(Subprocess* process : processes){
+        try{
+            results->push_back(co_await process->run());
+        }catch(std::runtime_error&){
+            results->push_back(RunResult());
+        }
+    }
+    (*done)++;
+    done->notify_all();
+}
+UTEST(Subprocess, Coroutine)
+{
+    // one after the other, without a thread waiting in between
+    Subprocess first("first",TASK " 2 100 1");
+    Subprocess invalid("invalid","invalid 1 2 3");
+    Subprocess second("second",TASK " 2 100 2");
+    std::vector<RunResult> results;
+    std::atomic<int> done(0);
+    run_in_order({&first, &invalid, &second}, &results, &done);
+    done.wait(0);
+    ASSERT_EQ(3u, results.size());
+    EXPECT_EQ(1, results[0].return_code);
+    EXPECT_TRUE(results[0].process == &first);
+    // the start failure is thrown from co_await
+    EXPECT_TRUE(results[1].process == nullptr);
+    EXPECT_EQ(2, results[2].return_code);
+    EXPECT_TRUE(second.m_start_time >= first.m_end_time);
+    // many in flight at once
+    const int count = 50;
+    std::vector<std::unique_ptr<Subprocess>> processes;
+    std::vector<std::vector<RunResult>> many(count);
+    std::atomic<int> finished(0);
+    for(int i = 0; i < count; i++){
+        processes.emplace_back(new Subprocess("many" + std::to_string(i), TASK " 1 100 " + std::to_string(i % 7)));
+        run_in_order({processes.back().get()}, &many[i], &finished);
+    }
+    for(int seen = finished.load(); seen < count; seen = finished.load()){
+        finished.wait(seen);
+    }
+    for(int i = 0; i < count; i++){
+        ASSERT_EQ(1u, many[i].size());
+        EXPECT_EQ(i % 7, many[i][0].return_code);
+    }
+}
+UTEST(Subprocess, OutputLines)
+{
+    Subprocess *process = new Subprocess("lines",TASK " 3 0 0");
+    process->start();
+    EXPECT_EQ(0, process->m_return_code);
+    EXPECT_EQ(3, (int)process->m_output.line_count());
+    for(std::string_view line : process->m_output.lines()){
+        EXPECT_EQ(0, (int)line.find("Output:"));
+    }
+    delete process;
+}
+UTEST(Subprocess, Redirection)
+{
+    // redirected streams bypass the parent: nothing lands in m_output
+    Subprocess to_file("to_file", TASK " 3 1 0", "", "", {{}}, Redirect_Null, Redirect("redirect.txt"));
+    to_file.start();
+    EXPECT_EQ(0, to_file.m_return_code);
+    EXPECT_EQ((size_t)0, to_file.m_output.size());
+    Subprocess append("append", TASK " 2 1 0", "", "", {{}}, Redirect_Null, Redirect("redirect.txt", true));
+    append.start();
+    std::ifstream file("redirect.txt", std::ios::binary);
+    std::string written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    EXPECT_EQ((size_t)5, (size_t)std::count(written.begin(), written.end(), '\n'));
+    // to /dev/null
+    Subprocess to_null("to_null", TASK " 3 1 0", "", "", {{}}, Redirect_Null, Redirect_Null);
+    EXPECT_EQ(0, to_null.start()->m_return_code);
+    EXPECT_EQ((size_t)0, to_null.m_output.size());
+#ifndef _WIN32
+    // file as stdin, piped stdout
+    Subprocess from_file("from_file", "cat", "", "", {{}}, Redirect("redirect.txt"));
+    from_file.start();
+    EXPECT_TRUE(written == from_file.m_output.str());
+    // existing descriptor
+    FILE* target = tmpfile();
+    Subprocess to_fd("to_fd", "echo fd", "", "", {{}}, Redirect_Null, Redirect(fileno(target)));
+    to_fd.start();
+    char buffer[16] = {};
+    rewind(target);
+    EXPECT_EQ((size_t)3, fread(buffer, 1, sizeof(buffer), target));
+    EXPECT_STREQ("fd" NEWLINE, buffer);
+    fclose(target);
+#endif
+    std::filesystem::remove("redirect.txt");
+    Subprocess missing("missing", TASK " 1 1 0", "", "", {{}}, Redirect("no/such/dir/in.txt"));
+    EXPECT_EXCEPTION({missing.start_async();}, std::runtime_error);
+}
+
+UTEST(Subprocess, Stderr)
+{
+    // on its own pipe: task reports a failure on stderr
+    Subprocess split("split", TASK " 2 1 3", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Pipe);
+    split.start();
+    EXPECT_EQ(3, split.m_return_code);
+    EXPECT_EQ((size_t)2, split.m_output.line_count());
+    std::string errors = split.m_error_output.str();
+    EXPECT_NE(std::string::npos, errors.find("Error :"));
+    EXPECT_TRUE(split.m_output_order.empty());
+    // stderr can only follow stdout, not the other way round
+    Subprocess wrong("wrong", TASK " 1 1 0", "", "", {{}}, Redirect_Null, Redirect_Stdout);
+    EXPECT_EXCEPTION({wrong.start_async();}, std::runtime_error);
+#ifndef _WIN32
+    // both pipes, merged back in arrival order
+    const char* script = "sh -c 'echo out1; sleep 0.1; echo err1 >&2; sleep 0.1; echo out2'";
+    Subprocess ordered("ordered", script, "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Pipe);
+    ordered.m_record_order = true;
+    ordered.start();
+    EXPECT_TRUE(ordered.m_output.str() == "out1\nout2\n");
+    EXPECT_TRUE(ordered.m_error_output.str() == "err1\n");
+    EXPECT_EQ((size_t)3, ordered.m_output_order.size());
+    EXPECT_TRUE(ordered.merged_output() == "out1\nerr1\nout2\n");
+    // 2>&1: one pipe, exact order, nothing to merge
+    Subprocess combined("combined", "sh -c 'echo out1; echo err1 >&2; echo out2'", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Stdout);
+    combined.start();
+    EXPECT_TRUE(combined.m_output.str() == "out1\nerr1\nout2\n");
+    EXPECT_EQ((size_t)0, combined.m_error_output.size());
+    // 2>&1 to a file
+    Subprocess to_file("to_file", "sh -c 'echo out; echo err >&2'", "", "", {{}}, Redirect_Null, Redirect("combined.txt"), Redirect_Stdout);
+    to_file.start();
+    std::ifstream file("combined.txt");
+    std::string written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::filesystem::remove("combined.txt");
+    EXPECT_TRUE(written == "out\nerr\n");
+#endif
+}
+
+UTEST(Subprocess, Callbacks)
+{
+    // output is handed over as it arrives, as views into the buffers
+    Subprocess task("task", TASK " 3 1 2", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Pipe);
+    size_t chunk_bytes[2] = {0, 0};
+    std::vector<std::string> lines[2];
+    int exits = 0;
+    int exit_code = -1;
+    task.m_on_chunk = [&](Stream_ stream, std::string_view data){ chunk_bytes[stream] += data.size(); };
+    task.m_on_line = [&](Stream_ stream, std::string_view line){ lines[stream].emplace_back(line); };
+    task.m_on_exit = [&](Subprocess& process){
+        exits++;
+        exit_code = process.m_return_code;
+    };
+    task.start();
+    EXPECT_EQ(1, exits);
+    EXPECT_EQ(2, exit_code);
+    EXPECT_EQ(task.m_output.size(), chunk_bytes[Stream_Stdout]);
+    EXPECT_EQ(task.m_error_output.size(), chunk_bytes[Stream_Stderr]);
+    ASSERT_EQ((size_t)3, lines[Stream_Stdout].size());
+    for(size_t i = 0; i < 3; i++){
+        EXPECT_TRUE(lines[Stream_Stdout][i] == std::string(task.m_output.line(i)));
+    }
+    // the unterminated error message arrives once the pipe is closed
+    EXPECT_TRUE(std::any_of(lines[Stream_Stderr].begin(), lines[Stream_Stderr].end(), [](const std::string& line){ return line.rfind("Error :", 0) == 0; }));
+    // nothing retained, lines still whole across reads
+    Subprocess counter("counter", TASK " 20 0 0");
+    counter.m_output.set_capture(Capture_None);
+    size_t whole = 0;
+    counter.m_on_line = [&](Stream_, std::string_view line){ whole += line.rfind("Output:", 0) == 0 ? 1 : 0; };
+    counter.start();
+    EXPECT_EQ((size_t)20, whole);
+    EXPECT_EQ((size_t)0, counter.m_output.size());
+#ifdef __linux__
+    // spliced into the log and not retained: still tee()d for the callbacks
+    Subprocess spliced("spliced", TASK " 20 0 0", "", "spliced.txt");
+    spliced.m_output.set_capture(Capture_None);
+    spliced.m_log_policy.splice = true;
+    size_t spliced_lines = 0;
+    size_t spliced_bytes = 0;
+    spliced.m_on_chunk = [&](Stream_, std::string_view data){ spliced_bytes += data.size(); };
+    spliced.m_on_line = [&](Stream_, std::string_view line){ spliced_lines += line.rfind("Output:", 0) == 0 ? 1 : 0; };
+    spliced.start();
+    std::ifstream log("spliced.txt", std::ios::binary);
+    std::string logged((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+    log.close();
+    std::filesystem::remove("spliced.txt");
+    EXPECT_EQ((size_t)20, spliced_lines);
+    EXPECT_EQ(logged.size(), spliced_bytes);
+    EXPECT_EQ((size_t)0, spliced.m_output.size());
+#endif
+}
+
+#ifndef _WIN32
+UTEST(Subprocess, Stdin)
+{
+    // far more than a pipe holds, echoed back while it is written: the
+    // reactor feeds stdin and drains stdout without either side blocking
+    std::string input;
+    for(int i = 0; input.size() < 8 * 1024 * 1024; i++){
+        input += "line " + std::to_string(i) + "\n";
+    }
+    std::atomic<int> written(0);
+    Subprocess echo("echo", "cat", "", "", {{}}, Redirect_Pipe);
+    // queued before the start, caller owned buffer first
+    echo.write_stdin(input.data(), input.size() / 2, [&](bool ok){ written += ok ? 1 : 100; });
+    echo.start_async();
+    echo.write_stdin(input.substr(input.size() / 2), [&](bool ok){ written += ok ? 1 : 100; });
+    echo.close_stdin();
+    echo.join();
+    EXPECT_EQ(0, echo.m_return_code);
+    EXPECT_EQ(2, written.load());
+    EXPECT_EQ(input.size(), echo.m_output.size());
+    EXPECT_TRUE(input == echo.m_output.str());
+    // writes after the end of input or the exit are dropped
+    echo.write_stdin("late", [&](bool ok){ written += ok ? 1 : 100; });
+    EXPECT_EQ(102, written.load());
+    // a child closing its stdin fails the write instead of raising SIGPIPE
+    std::atomic<int> dropped(0);
+    Subprocess closer("closer", "sh -c 'exec 0<&-; sleep 0.2'", "", "", {{}}, Redirect_Pipe);
+    closer.write_stdin(input, [&](bool ok){ dropped += ok ? 100 : 1; });
+    closer.start();
+    EXPECT_EQ(0, closer.m_return_code);
+    EXPECT_EQ(1, dropped.load());
+    // stdin must be a pipe
+    Subprocess unpiped("unpiped", "cat");
+    EXPECT_EXCEPTION({unpiped.write_stdin("data");}, std::runtime_error);
+}
+#endif
+UTEST(Subprocess, SpawnErrors)
+{
+    // failures inside the child are reported by start_async() and leave no process behind
+    Subprocess bad_dir("bad_dir", TASK " 1 1 0", "no/such/dir");
+    EXPECT_EXCEPTION({bad_dir.start_async();}, std::runtime_error);
+    EXPECT_EQ(Subprocess_NotStarted, bad_dir.m_state.load());
+#ifndef _WIN32
+    Subprocess not_executable("not_executable", TEST_DIR "test_env_1.sh");
+    EXPECT_EXCEPTION({not_executable.start_async();}, std::runtime_error);
+    // the same object can be started once the problem is fixed
+    bad_dir.m_curr_directory = "";
+    EXPECT_EQ(0, bad_dir.start()->m_return_code);
+#endif
+}
+
+#ifdef __linux__
+UTEST(Subprocess, Affinity)
+{
+    EXPECT_TRUE(parse_cpu_list("0-2,5\n") == std::vector<int>({0, 1, 2, 5}));
+    EXPECT_TRUE(parse_cpu_list("1-x").empty());
+    // the child is pinned before it execs
+    std::vector<int> cpus = allowed_cpus();
+    ASSERT_FALSE(cpus.empty());
+    Subprocess pinned("pinned", "grep Cpus_allowed_list /proc/self/status");
+    pinned.m_cpus = {cpus.back()};
+    EXPECT_EQ(0, pinned.start()->m_return_code);
+    EXPECT_STREQ(("Cpus_allowed_list:\t" + std::to_string(cpus.back()) + "\n").c_str(), pinned.m_output.str().c_str());
+    std::vector<int> nodes = numa_nodes();
+    if(!nodes.empty()){
+        Subprocess on_node("on_node", "grep Cpus_allowed_list /proc/self/status");
+        on_node.m_numa_node = nodes.front();
+        EXPECT_EQ(0, on_node.start()->m_return_code);
+    }
+    Subprocess bad_node("bad_node", TASK " 1 1 0");
+    bad_node.m_numa_node = 100000;
+    EXPECT_EXCEPTION({bad_node.start();}, std::runtime_error);
+    Subprocess bad_cpu("bad_cpu", TASK " 1 1 0");
+    bad_cpu.m_cpus = {-1};
+    EXPECT_EXCEPTION({bad_cpu.start();}, std::runtime_error);
+    // the manager spreads unpinned processes over the allowed CPUs
+    SubprocessManager manager;
+    manager.m_placement = Placement_Cores;
+    for(int i = 0; i < 4; i++){
+        manager.add("spread" + std::to_string(i), TASK " 1 1 0");
+    }
+    manager.start();
+    for(Subprocess* process : manager.m_processes){
+        EXPECT_EQ(0, process->m_return_code);
+        ASSERT_EQ((size_t)1, process->m_cpus.size());
+        EXPECT_TRUE(std::find(cpus.begin(), cpus.end(), process->m_cpus[0]) != cpus.end());
+    }
+}
+#endif
+UTEST(Subprocess, ResourceUsage)
+{
+    // wall time runs from start to exit
+    Subprocess sleeper("sleeper", TASK " 3 100 0");
+    EXPECT_EQ(0, sleeper.start()->m_return_code);
+    EXPECT_GE(sleeper.m_duration, 0.3);
+    EXPECT_LT(sleeper.m_duration, 10.0);
+    EXPECT_TRUE(sleeper.m_end_time > sleeper.m_start_time);
+    EXPECT_GT(sleeper.m_usage.max_rss_kb, 0);
+    // sleeping is waiting, not computing
+    EXPECT_LT(sleeper.m_usage.user_time + sleeper.m_usage.system_time, sleeper.m_duration);
+#ifndef _WIN32
+    EXPECT_GT(sleeper.m_usage.voluntary_switches, 0);
+    // a busy child shows up as CPU time
+    SubprocessManager manager;
+    manager.add("busy", "sh -c 'i=0; while [ $i -lt 300000 ]; do i=$((i+1)); done'");
+    manager.add("idle", TASK " 1 100 0");
+    manager.start();
+    Subprocess* busy = manager["busy"];
+    EXPECT_EQ(0, busy->m_return_code);
+    EXPECT_GT(busy->m_usage.user_time + busy->m_usage.system_time, 0.0);
+    EXPECT_GT(busy->m_usage.minor_faults, 0);
+    // the manager adds the counters up and keeps the largest peak
+    double cpu = busy->m_usage.user_time + manager["idle"]->m_usage.user_time;
+    EXPECT_NEAR(cpu, manager.m_usage.user_time, 1e-9);
+    EXPECT_EQ(std::max(busy->m_usage.max_rss_kb, manager["idle"]->m_usage.max_rss_kb), manager.m_usage.max_rss_kb);
+#endif
+}
+#ifndef _WIN32
+UTEST(Subprocess, ResourceLimits)
+{
+    // limits are in place when the child starts
+    ResourceLimits limits;
+    limits.open_files = 16;
+    limits.core_size = 0;
+    Subprocess limited("limited", "sh -c 'ulimit -n; ulimit -c'", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Inherit, limits);
+    EXPECT_EQ(0, limited.start()->m_return_code);
+    EXPECT_EQ(Exit_Normal, limited.m_exit_reason);
+    EXPECT_STREQ("16\n0\n", limited.m_output.str().c_str());
+    // a request above the inherited hard limit is lowered to it
+    ResourceLimits too_high;
+    too_high.open_files = 1ll << 40;
+    Subprocess clamped("clamped", TASK " 1 1 0", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Inherit, too_high);
+    EXPECT_EQ(0, clamped.start()->m_return_code);
+    // a spinning child is stopped at its CPU limit
+    SubprocessManager manager;
+    ResourceLimits cpu;
+    cpu.cpu_time = 1;
+    manager.add("spin", "sh -c 'while :; do :; done'", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Inherit, cpu);
+    manager.add("signal", "sh -c 'kill -TERM $$'");
+#ifndef __SANITIZE_THREAD__
+    // (the sanitizer runtime cannot allocate in a child under an address space limit)
+    ResourceLimits memory;
+    memory.address_space = 512ll << 20;
+    manager.add("memory", "sh -c 'ulimit -v'", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Inherit, memory);
+    // a crash under a memory limit is blamed on the limit
+    manager.add("abort", "sh -c 'kill -ABRT $$'", "", "", {{}}, Redirect_Null, Redirect_Pipe, Redirect_Inherit, memory);
+#endif
+    manager.start();
+    EXPECT_EQ(Exit_CpuLimit, manager["spin"]->m_exit_reason);
+    EXPECT_GT(manager["spin"]->m_usage.user_time + manager["spin"]->m_usage.system_time, 0.9);
+    EXPECT_EQ(Exit_Signal, manager["signal"]->m_exit_reason);
+    EXPECT_EQ(128 + SIGTERM, manager["signal"]->m_return_code);
+#ifndef __SANITIZE_THREAD__
+    EXPECT_STREQ("524288\n", manager["memory"]->m_output.str().c_str());
+    EXPECT_EQ(Exit_MemoryLimit, manager["abort"]->m_exit_reason);
+    EXPECT_EQ(128 + SIGABRT, manager["abort"]->m_return_code);
+#endif
+}
+#endif
+UTEST(Subprocess, Timeouts)
+{
+    // a child running past m_timeout is stopped
+    Subprocess slow("slow", TASK " 100 100 0");
+    slow.m_timeout = 0.3;
+    slow.start();
+    EXPECT_EQ(Exit_Timeout, slow.m_exit_reason);
+    EXPECT_GE(slow.m_duration, 0.3);
+    EXPECT_LT(slow.m_duration, 5.0);
+    // steady output keeps the idle timeout away, silence triggers it
+    SubprocessManager manager;
+    manager.add("chatty", TASK " 6 100 0");
+    manager["chatty"]->m_idle_timeout = 0.4;
+#ifdef _WIN32
+    manager.add("silent", "cmd /c \"echo start & ping -n 30 127.0.0.1 > NUL\"");
+#else
+    manager.add("silent", "sh -c 'echo start; exec sleep 30'");
+    // SIGTERM is ignored: SIGKILL follows after the grace period
+    manager.add("stubborn", "sh -c 'trap \"\" TERM; exec sleep 30'");
+    manager["stubborn"]->m_timeout = 0.2;
+    manager["stubborn"]->m_kill_grace = 0.2;
+#endif
+    manager["silent"]->m_idle_timeout = 0.3;
+    manager.start();
+    EXPECT_EQ(Exit_Normal, manager["chatty"]->m_exit_reason);
+    EXPECT_EQ(0, manager["chatty"]->m_return_code);
+    EXPECT_EQ(Exit_IdleTimeout, manager["silent"]->m_exit_reason);
+    EXPECT_LT(manager["silent"]->m_duration, 5.0);
+#ifndef _WIN32
+    EXPECT_EQ(128 + SIGTERM, manager["silent"]->m_return_code);
+    EXPECT_EQ(Exit_Timeout, manager["stubborn"]->m_exit_reason);
+    EXPECT_EQ(128 + SIGKILL, manager["stubborn"]->m_return_code);
+    EXPECT_GE(manager["stubborn"]->m_duration, 0.4);
+#endif
+}
+#ifndef _WIN32
+UTEST(Subprocess, Terminate)
+{
+    // the whole process group goes, including what the child started
+    std::filesystem::remove("grandchild.txt");
+    Subprocess tree("tree", "sh -c 'sleep 30 & echo $! > grandchild.tmp; mv grandchild.tmp grandchild.txt; wait'");
+    tree.start_async();
+    for(int i = 0; i < 500 && !std::filesystem::exists("grandchild.txt"); i++){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::ifstream file("grandchild.txt");
+    int grandchild = 0;
+    file >> grandchild;
+    file.close();
+    std::filesystem::remove("grandchild.txt");
+    ASSERT_GT(grandchild, 1);
+    EXPECT_EQ(Subprocess_Terminated, tree.terminate()->m_state.load());
+    EXPECT_EQ(Exit_Terminated, tree.m_exit_reason);
+    EXPECT_EQ(128 + SIGKILL, tree.m_return_code);
+    EXPECT_LT(tree.m_duration, 5.0);
+    // the orphaned sleep was killed too (init may not have reaped it yet)
+    bool gone = false;
+    for(int i = 0; i < 100 && !gone; i++){
+        std::ifstream stat("/proc/" + std::to_string(grandchild) + "/stat");
+        std::string pid, comm, state;
+        gone = !(stat >> pid >> comm >> state) || state == "Z";
+        if(!gone){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    EXPECT_TRUE(gone);
+    // a completed process is left alone
+    Subprocess done("done", TASK " 1 1 0");
+    done.start()->terminate();
+    EXPECT_EQ(Exit_Normal, done.m_exit_reason);
+    EXPECT_EQ(0, done.m_return_code);
+}
+#endif
+UTEST(OutputBuffer, ChunkBoundaries)
+{
+    // lines straddling chunk boundaries must come back whole
+    OutputBuffer buffer;
+    std::string expected;
+    std::vector<std::string> lines;
+    for(int i = 0; i < 20000; i++){
+        lines.push_back(std::string(i % 97, 'a' + i % 26) + std::to_string(i));
+        if(i == 10000){
+            // long lines are continued in place and joined, not carried
+            lines.back() = std::string(2 * OutputBuffer::CHUNK_SIZE + 5, 'y');
+        }
+        expected += lines.back() + "\n";
+    }
+    lines.push_back(std::string(3 * OutputBuffer::CHUNK_SIZE, 'z'));
+    expected += lines.back();
+    std::vector<std::string> recent;
+    for(size_t pos = 0; pos < expected.size();){
+        // one commit per read, as the reactor does
+        size_t size;
+        char* target = buffer.prepare(size);
+        size = std::min<size_t>({size, 4093, expected.size() - pos});
+        std::memcpy(target, expected.data() + pos, size);
+        buffer.commit(size);
+        pos += size;
+        std::vector<std::string_view> completed;
+        buffer.recent_lines(completed);
+        recent.insert(recent.end(), completed.begin(), completed.end());
+    }
+    EXPECT_TRUE(lines.back() == buffer.snapshot().partial());
+    buffer.finish();
+    std::vector<std::string_view> completed;
+    buffer.recent_lines(completed);
+    recent.insert(recent.end(), completed.begin(), completed.end());
+    EXPECT_EQ(expected.size(), buffer.size());
+    EXPECT_TRUE(expected == buffer.str());
+    ASSERT_EQ(lines.size(), buffer.line_count());
+    ASSERT_EQ(lines.size(), recent.size());
+    std::vector<std::string_view> views = buffer.lines();
+    OutputSnapshot snapshot = buffer.snapshot();
+    std::vector<std::string_view> snapshot_lines = snapshot.lines();
+    ASSERT_EQ(lines.size(), snapshot_lines.size());
+    for(size_t i = 0; i < lines.size(); i++){
+        EXPECT_TRUE(lines[i] == buffer.line(i));
+        EXPECT_TRUE(lines[i] == views[i]);
+        EXPECT_TRUE(lines[i] == recent[i]);
+        EXPECT_TRUE(lines[i] == snapshot_lines[i]);
+    }
+}
+UTEST(OutputBuffer, Recent)
+{
+    OutputBuffer buffer;
+    std::vector<std::string_view> lines;
+    buffer.append("ab\ncd\nef", 8);
+    EXPECT_TRUE(buffer.recent() == "ab\ncd\nef");
+    buffer.recent_lines(lines);
+    ASSERT_EQ((size_t)2, lines.size());
+    EXPECT_TRUE(lines[0] == "ab" && lines[1] == "cd");
+    // a line completed by a later read starts in the earlier one
+    lines.clear();
+    buffer.append("gh\r\n", 4);
+    EXPECT_TRUE(buffer.recent() == "gh\r\n");
+    buffer.recent_lines(lines);
+    ASSERT_EQ((size_t)1, lines.size());
+    EXPECT_TRUE(lines[0] == "efgh");
+    // finish() completes the trailing line
+    lines.clear();
+    buffer.append("ij", 2);
+    buffer.finish();
+    EXPECT_TRUE(buffer.recent().empty());
+    buffer.recent_lines(lines);
+    ASSERT_EQ((size_t)1, lines.size());
+    EXPECT_TRUE(lines[0] == "ij");
+}
+
+UTEST(OutputBuffer, Filters)
+{
+    const std::string colored = "a\r\nb\x1b[1;31mred\x1b[0m\r\n\x1b]0;title\x07" "c\rd\r\n";
+    OutputBuffer raw;
+    raw.append(colored.data(), colored.size());
+    raw.finish();
+    EXPECT_TRUE(raw.str() == colored);
+    EXPECT_TRUE(raw.line(0) == "a");
+    OutputBuffer clean;
+    clean.set_filter(Filter_CRLF | Filter_ANSI);
+    // one byte per read: CRLF pairs and escapes split across every boundary
+    for(char c : colored){
+        clean.append(&c, 1);
+    }
+    clean.finish();
+    EXPECT_TRUE(clean.str() == "a\nbred\nc\rd\n");
+    ASSERT_EQ(3u, clean.line_count());
+    EXPECT_TRUE(clean.line(1) == "bred");
+    EXPECT_TRUE(clean.line(2) == "c\rd");
+}
+UTEST(OutputBuffer, TailRetention)
+{
+    // the tail modes keep the newest output in constant memory
+    std::string text;
+    std::vector<std::string> lines;
+    for(int i = 0; i < 200000; i++){
+        lines.push_back(std::string(i % 53, 'a' + i % 26) + std::to_string(i));
+        text += lines.back() + "\n";
+    }
+    OutputBuffer by_bytes;
+    by_bytes.set_capture(Capture_TailBytes, 100000);
+    OutputBuffer by_lines;
+    by_lines.set_capture(Capture_TailLines, 1000);
+    size_t chunk_count = 0;
+    for(size_t pos = 0; pos < text.size(); pos += 4093){
+        size_t size = std::min<size_t>(4093, text.size() - pos);
+        by_bytes.append(text.data() + pos, size);
+        by_lines.append(text.data() + pos, size);
+        if(pos == 4093 * 1000){
+            chunk_count = by_bytes.chunks().size();
+        }
+    }
+    by_bytes.finish();
+    by_lines.finish();
+    EXPECT_LE(by_bytes.chunks().size(), chunk_count + 1);
+
+    EXPECT_EQ(text.size(), by_bytes.bytes_seen());
+    EXPECT_EQ((size_t)100000, by_bytes.size());
+    EXPECT_EQ(text.size() - 100000, by_bytes.bytes_dropped());
+    EXPECT_TRUE(text.substr(text.size() - 100000) == by_bytes.str());
+    size_t first = lines.size() - by_bytes.line_count();
+    EXPECT_EQ(first, by_bytes.lines_dropped());
+    EXPECT_TRUE(lines[first] == by_bytes.line(0));
+    EXPECT_TRUE(lines.back() == by_bytes.lines().back());
+
+    EXPECT_EQ(lines.size(), by_lines.lines_seen());
+    ASSERT_EQ((size_t)1000, by_lines.line_count());
+    EXPECT_EQ(lines.size() - 1000, by_lines.lines_dropped());
+    std::vector<std::string_view> views = by_lines.lines();
+    std::string expected;
+    for(size_t i = 0; i < 1000; i++){
+        EXPECT_TRUE(lines[lines.size() - 1000 + i] == by_lines.line(i));
+        EXPECT_TRUE(lines[lines.size() - 1000 + i] == views[i]);
+        expected += lines[lines.size() - 1000 + i] + "\n";
+    }
+    EXPECT_TRUE(expected == by_lines.str());
+    EXPECT_EQ(text.size() - expected.size(), by_lines.bytes_dropped());
+}
+
+UTEST(OutputBuffer, ConcurrentSnapshots)
+{
+    // readers tail a writer without locking it: every snapshot is a prefix
+    // of the text, cut into whole lines
+    std::string text;
+    for(int i = 0; i < 20000; i++){
+        text += std::string(i % 37, 'x') + std::to_string(i) + "\n";
+    }
+    text += "tail";
+    OutputBuffer buffer;
+    std::atomic<int> errors(0);
+    std::atomic<int> snapshots(0);
+    auto tail = [&](){
+        size_t last_size = 0;
+        bool finished = false;
+        while(!finished){
+            OutputSnapshot snapshot = buffer.snapshot();
+            finished = snapshot.finished();
+            size_t size = snapshot.size();
+            std::vector<std::string_view> lines = snapshot.lines();
+            size_t complete = (size_t)std::count(text.begin(), text.begin() + size, '\n');
+            size_t partial = size - (complete == 0 ? 0 : text.rfind('\n', size - 1) + 1);
+            bool ok = size >= last_size && snapshot.str() == text.substr(0, size);
+            ok = ok && lines.size() == complete + (finished ? 1 : 0);
+            ok = ok && snapshot.partial() == (finished ? std::string_view() : std::string_view(text).substr(size - partial, partial));
+            if(ok && complete != 0){
+                size_t index = complete - 1;
+                ok = lines[index] == std::string(index % 37, 'x') + std::to_string(index);
+            }
+            errors += ok ? 0 : 1;
+            snapshots++;
+            last_size = size;
+            std::this_thread::yield();
+        }
+    };
+    std::vector<std::thread> readers;
+    for(int i = 0; i < 4; i++){
+        readers.emplace_back(tail);
+    }
+    std::mt19937 random(7);
+    for(size_t pos = 0; pos < text.size();){
+        size_t size = std::min<size_t>(1 + random() % 5000, text.size() - pos);
+        buffer.append(text.data() + pos, size);
+        pos += size;
+    }
+    buffer.finish();
+    for(std::thread& reader : readers){
+        reader.join();
+    }
+    EXPECT_EQ(0, errors.load());
+    EXPECT_GE(snapshots.load(), 4);
+    // the tail modes recycle chunks under the readers: no snapshots
+    OutputBuffer tail_buffer;
+    tail_buffer.set_capture(Capture_TailLines, 10);
+    EXPECT_EXCEPTION({tail_buffer.snapshot();}, std::runtime_error);
+#ifndef _WIN32
+    // readers of a running process see whole, consecutive lines
+    Subprocess counting("counting", "seq 1 50000");
+    counting.start_async();
+    auto follow = [&](){
+        bool finished = false;
+        while(!finished){
+            OutputSnapshot snapshot = counting.m_output.snapshot();
+            finished = snapshot.finished();
+            std::vector<std::string_view> lines = snapshot.lines();
+            if(!lines.empty() && lines.back() != std::to_string(lines.size())){
+                errors++;
+            }
+            std::this_thread::yield();
+        }
+    };
+    readers.clear();
+    for(int i = 0; i < 4; i++){
+        readers.emplace_back(follow);
+    }
+    for(std::thread& reader : readers){
+        reader.join();
+    }
+    counting.join();
+    EXPECT_EQ(0, errors.load());
+    EXPECT_EQ((size_t)50000, counting.m_output.snapshot().lines().size());
+#endif
+}
+
+UTEST(LineScanner, Implementations)
+{
+    // every implementation must agree with the scalar one, whatever the split
+    const char alphabet[] = {'a', 'b', '\n', '\r', '\x1b', '[', ']', 'm', '1', ';', '\x07', '\\', '('};
+    std::mt19937 random(42);
+    std::string input;
+    for(int i = 0; i < 200000; i++){
+        input += alphabet[random() % sizeof(alphabet)];
+    }
+    for(unsigned filter = 0; filter < 4; filter++){
+        std::string expected = input;
+        std::vector<uint32_t> expected_ends;
+        ScanState state = {};
+        expected.resize(scan_lines(expected.data(), expected.size(), filter, state, expected_ends, 0, ScanImpl_Scalar));
+        for(ScanImpl_ impl : {ScanImpl_SSE2, ScanImpl_AVX2, ScanImpl_Auto}){
+            std::string actual = input;
+            std::vector<uint32_t> actual_ends;
+            ScanState actual_state = {};
+            actual.resize(scan_lines(actual.data(), actual.size(), filter, actual_state, actual_ends, 0, impl));
+            EXPECT_TRUE(expected == actual);
+            EXPECT_TRUE(expected_ends == actual_ends);
+        }
+        OutputBuffer whole;
+        whole.set_filter(filter);
+        whole.append(input.data(), input.size());
+        whole.finish();
+        OutputBuffer split;
+        split.set_filter(filter);
+        for(size_t pos = 0; pos < input.size();){
+            size_t count = std::min<size_t>(1 + random() % 5000, input.size() - pos);
+            split.append(input.data() + pos, count);
+            pos += count;
+        }
+        split.finish();
+        EXPECT_TRUE(whole.str() == split.str());
+        EXPECT_TRUE(whole.lines() == split.lines());
+    }
+}
+UTEST(TimerWheel, Deadlines)
+{
+    // timers on every level fire at the first advance past their deadline,
+    // driven by next_timeout_ms() as the reactor does
+    TimerWheel wheel;
+    auto now = TimerWheel::Clock::now();
+    EXPECT_EQ(-1, wheel.next_timeout_ms(now));
+    std::mt19937 random(7);
+    std::vector<TimerWheel::Clock::time_point> deadlines;
+    std::vector<uint64_t> ids;
+    std::vector<int> fired;
+    for(int i = 0; i < 3000; i++){
+        // up to ~18 minutes out
+        deadlines.push_back(now + std::chrono::microseconds(random() % (1u << (random() % 31))));
+        ids.push_back(wheel.add(deadlines.back(), [&fired, i](){ fired.push_back(i); }));
+    }
+    for(size_t i = 0; i < ids.size(); i += 7){
+        wheel.cancel(ids[i]);
+    }
+    size_t expected = wheel.size();
+    std::vector<std::pair<uint64_t,TimerWheel::Callback>> expired;
+    while(wheel.size() > 0){
+        int wait = wheel.next_timeout_ms(now);
+        ASSERT_GE(wait, 0);
+        ASSERT_LE(wait, 256);
+        now += std::chrono::milliseconds(wait == 0 ? 1 : wait);
+        size_t before = fired.size();
+        wheel.advance(now, expired);
+        for(auto& timer : expired){
+            timer.second();
+        }
+        expired.clear();
+        for(size_t i = before; i < fired.size(); i++){
+            EXPECT_TRUE(deadlines[fired[i]] <= now);
+            EXPECT_TRUE(deadlines[fired[i]] + std::chrono::milliseconds(2) > now);
+        }
+    }
+    EXPECT_EQ(expected, fired.size());
+    for(int i : fired){
+        EXPECT_NE(0, i % 7);
+    }
+}
+UTEST(Environment, Overlay)
+{
+    // overlay entries replace or extend the snapshot, the first duplicate wins
+    const char* envp[] = {"B=2", "A=1", "C=3", "A=duplicate", "BAD", nullptr};
+    Environment environment(envp);
+    EXPECT_EQ((size_t)3, environment.size());
+    EnvironmentBlock block = environment.build({{"B", "x"}, {"D", "4"}, {"", ""}});
+    std::vector<std::string> entries;
+#ifdef _WIN32
+    for(const char* entry = block.text; *entry != '\0'; entry += strlen(entry) + 1){
+        entries.push_back(entry);
+    }
+#else
+    for(char** entry = block.envp; *entry != nullptr; entry++){
+        entries.push_back(*entry);
+    }
+#endif
+    std::vector<std::string> expected = {"A=1", "B=x", "C=3", "D=4"};
+    EXPECT_TRUE(expected == entries);
+}
+
 UTEST(SubprocessManager, Multiprocess)
 {
     SubprocessManager manager = SubprocessManager();
-    Subprocess *process1 = new Subprocess("process1","task.exe 2 100 1");
+    Subprocess *process1 = new Subprocess("process1",TASK " 2 100 1");
     manager.add(process1);
-    manager.add("process2","task.exe 3 100 2");
+    manager.add("process2",TASK " 3 100 2");
     EXPECT_EXCEPTION({manager.add(process1);},std::runtime_error);
-    EXPECT_EXCEPTION({manager.add("process2","task.exe 3 100 2");},std::runtime_error);
+    EXPECT_EXCEPTION({manager.add("process2",TASK " 3 100 2");},std::runtime_error);
     manager.start_async();
     EXPECT_EXCEPTION({manager.start();},std::runtime_error);
     manager.join();
@@ -70,13 +929,272 @@ UTEST(SubprocessManager, Multiprocess)
     SubprocessManager *manager1 =new SubprocessManager();
     EXPECT_EQ(
         {
-            SubprocessManager().add("process1","task.exe 2 100 1")
-                ->add("process2","task.exe 3 100 2")
+            SubprocessManager().add("process1",TASK " 2 100 1")
+                ->add("process2",TASK " 3 100 2")
                 ->start()
                 ->join()
                 ->terminate()
-                ->m_state;
+                ->m_state.load();
         }, Subprocess_Terminated
     );
 }
+UTEST(SubprocessManager, LogPolicies)
+{
+    // every policy leaves a complete log behind once the process completes
+    SubprocessManager manager;
+    LogFlush_ policies[] = {LogFlush_Interval, LogFlush_Size, LogFlush_Exit};
+    for(int i = 0; i < 30; i++){
+        std::string name = "log" + std::to_string(i);
+        manager.add(name, TASK " 5 1 0", "", name + ".txt");
+        manager[name]->m_log_policy.flush = policies[i % 3];
+        manager[name]->m_log_policy.bytes = 100;
+        manager[name]->m_log_policy.interval_ms = 2;
+        manager[name]->m_log_policy.splice = i % 5 == 0;
+        if(i % 10 == 0){
+            manager[name]->m_output.set_capture(Capture_None);
+        }
+    }
+    manager.start();
+    for(Subprocess* process : manager.m_processes){
+        std::ifstream log(process->m_log_path, std::ios::binary);
+        std::string logged((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(0, process->m_return_code);
+        EXPECT_EQ((size_t)5, (size_t)std::count(logged.begin(), logged.end(), '\n'));
+        if(process->m_output.capture() != Capture_None){
+            EXPECT_EQ((size_t)5, process->m_output.line_count());
+            EXPECT_TRUE(logged == process->m_output.str());
+        }else{
+            EXPECT_EQ((size_t)0, process->m_output.size());
+        }
+        log.close();
+        std::filesystem::remove(process->m_log_path);
+    }
+}
+UTEST(SubprocessManager, JobSlots)
+{
+    // never more than m_max_running children at a time
+    SubprocessManager manager;
+    manager.m_max_running = 2;
+    for(int i = 0; i < 8; i++){
+        manager.add("slot" + std::to_string(i), TASK " 1 50 0");
+    }
+    manager.add("invalid", "invalid 1 2 3");
+    manager.start();
+    std::vector<std::pair<double,int>> edges;
+    for(Subprocess* process : manager.m_processes){
+        if(process->m_name == "invalid"){
+            continue;
+        }
+        EXPECT_EQ(0, process->m_return_code);
+        EXPECT_TRUE(process->m_run_time >= 0.05);
+        edges.push_back({process->m_queue_wait, 1});
+        edges.push_back({process->m_queue_wait + process->m_run_time, -1});
+    }
+    std::sort(edges.begin(), edges.end());
+    int running = 0;
+    int most = 0;
+    for(auto& edge : edges){
+        running += edge.second;
+        most = std::max(most, running);
+    }
+    EXPECT_EQ(2, most);
+    EXPECT_TRUE(manager["slot7"]->m_queue_wait >= 0.15);
+    // a process that cannot start is reported instead of thrown
+    EXPECT_FALSE(manager["invalid"]->m_error.empty());
+    EXPECT_EQ(Subprocess_NotStarted, manager["invalid"]->m_state.load());
+    // the run time is final once the process is seen completed
+    SubprocessManager waited;
+    waited.add("waited", TASK " 1 50 0");
+    waited.start_async();
+    EXPECT_EQ(Subprocess_Completed, waited["waited"]->wait_for_state(Subprocess_Completed));
+    EXPECT_TRUE(waited["waited"]->m_run_time >= 0.05);
+    waited.join();
+    // one slot: queued processes start by priority, then in order
+    SubprocessManager ordered;
+    ordered.m_max_running = 1;
+    ordered.m_schedule = Schedule_Priority;
+    int priorities[] = {0, 5, 1, 5, 3};
+    for(int i = 0; i < 5; i++){
+        ordered.add("p" + std::to_string(i), TASK " 1 1 0");
+        ordered["p" + std::to_string(i)]->m_priority = priorities[i];
+    }
+    ordered.start();
+    const char* expected[] = {"p1", "p3", "p4", "p2", "p0"};
+    for(int i = 1; i < 5; i++){
+        EXPECT_TRUE(ordered[expected[i - 1]]->m_queue_wait < ordered[expected[i]]->m_queue_wait);
+    }
+#ifdef __linux__
+    // refills are started from the reactor thread: their children get no
+    // signal blocked, so `yes` in a pipeline dies of SIGPIPE as in a shell
+    SubprocessManager refilled;
+    refilled.m_max_running = 1;
+    refilled.add("first", TASK " 1 1 0")
+        ->add("mask", "grep SigBlk /proc/self/status")
+        ->add("pipeline", "sh -c \"yes | head -c 1\"");
+    refilled.start();
+    EXPECT_TRUE(refilled["mask"]->m_output.line(0) == "SigBlk:\t0000000000000000");
+    EXPECT_TRUE(refilled["pipeline"]->m_output.str() == "y");
+    EXPECT_EQ((size_t)0, refilled["pipeline"]->m_error_output.size());
+#endif
+}
+UTEST(SubprocessManager, Dependencies)
+{
+    // dependents start once all of their inputs have completed
+    SubprocessManager manager;
+    manager.m_max_running = 4;
+    manager.add("compile_a", TASK " 1 50 0")
+        ->add("compile_b", TASK " 1 100 0")
+        ->add("link", TASK " 1 10 0")
+        ->add("test", TASK " 1 10 0")
+        ->depends_on("link", {"compile_a", "compile_b"})
+        ->depends_on("test", {"link"});
+    manager.start();
+    auto end = [&](const char* name){ return manager[name]->m_queue_wait + manager[name]->m_run_time; };
+    EXPECT_TRUE(manager["link"]->m_queue_wait >= end("compile_b"));
+    EXPECT_TRUE(manager["test"]->m_queue_wait >= end("link"));
+    EXPECT_TRUE(manager.m_makespan >= end("test"));
+    EXPECT_TRUE(manager.m_makespan >= 0.12);
+    // one slot: the long chain goes first even though it was added last
+    SubprocessManager chain;
+    chain.m_max_running = 1;
+    chain.add("short", TASK " 1 1 0")
+        ->add("head", TASK " 1 1 0")
+        ->add("middle", TASK " 1 1 0")
+        ->add("tail", TASK " 1 1 0")
+        ->depends_on("middle", {"head"})
+        ->depends_on("tail", {"middle"});
+    chain.start();
+    EXPECT_TRUE(chain["head"]->m_queue_wait < chain["short"]->m_queue_wait);
+    // a failed process skips everything that depends on it
+    SubprocessManager failing;
+    failing.add("fails", TASK " 1 1 3")
+        ->add("skipped", TASK " 1 1 0")
+        ->add("also_skipped", TASK " 1 1 0")
+        ->add("independent", TASK " 1 1 0")
+        ->depends_on("skipped", {"fails"})
+        ->depends_on("also_skipped", {"skipped"});
+    failing.start();
+    EXPECT_EQ(3, failing["fails"]->m_return_code);
+    EXPECT_EQ(Subprocess_NotStarted, failing["skipped"]->m_state.load());
+    EXPECT_EQ(Subprocess_NotStarted, failing["also_skipped"]->m_state.load());
+    EXPECT_FALSE(failing["also_skipped"]->m_error.empty());
+    EXPECT_EQ(0, failing["independent"]->m_return_code);
+    // cycles and unknown names are rejected before anything runs
+    SubprocessManager cycle;
+    cycle.add("a", TASK " 1 1 0")->add("b", TASK " 1 1 0")->add("c", TASK " 1 1 0");
+    cycle.depends_on("a", {"c"})->depends_on("b", {"a"})->depends_on("c", {"b"});
+    EXPECT_EXCEPTION({cycle.start();}, std::runtime_error);
+    EXPECT_EQ(Subprocess_NotStarted, cycle["a"]->m_state.load());
+    SubprocessManager unknown;
+    unknown.add("a", TASK " 1 1 0")->depends_on("a", {"missing"});
+    EXPECT_EXCEPTION({unknown.start();}, std::runtime_error);
+}
+UTEST(SubprocessManager, TaskTable)
+{
+    // one slot: the first holds it, the others wait
+    SubprocessManager manager;
+    manager.m_max_running = 1;
+    manager.add("first", TASK " 1 200 0")->add("second", TASK " 1 1 0")->add("third", TASK " 1 1 0");
+    EXPECT_EQ(0u, manager.count(Subprocess_NotStarted));
+    manager.start_async();
+    EXPECT_EQ(1u, manager.count(Subprocess_InProgress));
+    EXPECT_EQ(2u, manager.count(Subprocess_NotStarted));
+    // running and queued tasks have not failed
+    EXPECT_TRUE(manager.failed().empty());
+    manager.join();
+    EXPECT_EQ(3u, manager.count(Subprocess_Completed));
+    EXPECT_TRUE(manager.failed().empty());
+    // failed, skipped and not started alike, by position
+    SubprocessManager failing;
+    failing.add("fails", TASK " 1 1 3")
+        ->add("invalid", "invalid 1 2 3")
+        ->add("independent", TASK " 1 1 0");
+    for(int i = 0; i < 2000; i++){
+        failing.add("skipped" + std::to_string(i), TASK " 1 1 0")->depends_on("skipped" + std::to_string(i), {"fails"});
+    }
+    failing.start();
+    EXPECT_EQ(2u, failing.count(Subprocess_Completed));
+    EXPECT_EQ(2001u, failing.count(Subprocess_NotStarted));
+    std::vector<size_t> failed = failing.failed();
+    ASSERT_EQ(2002u, failed.size());
+    EXPECT_EQ(0u, failed[0]);
+    EXPECT_EQ(1u, failed[1]);
+    EXPECT_EQ(3u, failed[2]);
+    EXPECT_EQ(0, failing["independent"]->m_return_code);
+}
+#ifndef _WIN32
+UTEST(SubprocessManager, Terminate)
+{
+    // running processes are killed, queued ones never start
+    SubprocessManager manager;
+    manager.m_max_running = 2;
+    for(int i = 0; i < 5; i++){
+        manager.add("sleeper" + std::to_string(i), TASK " 300 100 0");
+    }
+    manager.add("after", TASK " 1 1 0");
+    manager.depends_on("after", {"sleeper0"});
+    manager.start_async();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_EQ(Subprocess_Terminated, manager.terminate()->m_state.load());
+    EXPECT_LT(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(), 5.0);
+    int killed = 0;
+    for(Subprocess* process : manager.m_processes){
+        if(process->m_exit_reason == Exit_Terminated){
+            killed++;
+        }else{
+            EXPECT_EQ(Subprocess_NotStarted, process->m_state.load());
+            EXPECT_FALSE(process->m_error.empty());
+        }
+    }
+    EXPECT_EQ(2, killed);
+    EXPECT_STREQ("Dependency 'sleeper0' failed", manager["after"]->m_error.c_str());
+    // while completions start the next processes on the reactor thread: no
+    // child may escape the kill and keep terminate() waiting for it
+    for(int round = 0; round < 5; round++){
+        SubprocessManager busy;
+        busy.m_max_running = 1;
+        for(int i = 0; i < 40; i++){
+            busy.add("task" + std::to_string(i), i % 4 == 3 ? TASK " 300 100 0" : TASK " 1 1 0");
+        }
+        busy.start_async();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 * round));
+        auto stopped = std::chrono::steady_clock::now();
+        busy.terminate();
+        EXPECT_LT(std::chrono::duration<double>(std::chrono::steady_clock::now() - stopped).count(), 5.0);
+    }
+}
+UTEST(SubprocessManager, SpawnServer)
+{
+    // from here on every child is started by the helper (keep this test last)
+    SubprocessManager::start_spawn_server();
+    SubprocessManager manager;
+    manager.add("exit_code", TASK " 3 10 2");
+    manager.add("env", TEST_ENV_1, TEST_DIR, "", {{"ENV1_VAR","ENV1_Value"}});
+    manager.add("parent", "sh -c 'echo $PPID'");
+    manager.add("to_file", TASK " 4 1 0", "", "", {{}}, Redirect_Null, Redirect("spawn_server.txt"));
+    manager.add("pinned", "grep Cpus_allowed_list /proc/self/status");
+    manager["pinned"]->m_cpus = {allowed_cpus().front()};
+    manager.start();
+    EXPECT_STREQ(("Cpus_allowed_list:\t" + std::to_string(allowed_cpus().front()) + "\n").c_str(), manager["pinned"]->m_output.str().c_str());
+    EXPECT_EQ(2, manager["exit_code"]->m_return_code);
+    EXPECT_EQ((size_t)3, manager["exit_code"]->m_output.line_count());
+    // the helper forwards the rusage of its children
+    EXPECT_GT(manager["exit_code"]->m_usage.max_rss_kb, 0);
+    EXPECT_GE(manager["exit_code"]->m_duration, 0.03);
+    EXPECT_STREQ("ENV1_Value" NEWLINE, manager["env"]->m_output.str().c_str());
+    int parent = atoi(manager["parent"]->m_output.str().c_str());
+    EXPECT_TRUE(parent > 1 && parent != getpid());
+    EXPECT_EQ(0, manager["to_file"]->m_return_code);
+    std::ifstream redirected("spawn_server.txt");
+    std::string text((std::istreambuf_iterator<char>(redirected)), std::istreambuf_iterator<char>());
+    EXPECT_EQ((size_t)4, (size_t)std::count(text.begin(), text.end(), '\n'));
+    redirected.close();
+    std::filesystem::remove("spawn_server.txt");
+    // exec failures come back from the helper
+    Subprocess bad_dir("bad_dir", TASK " 1 1 0", "no/such/dir");
+    EXPECT_EXCEPTION({bad_dir.start_async();}, std::runtime_error);
+}
+#endif
+
 UTEST_MAIN();
\ No newline at end of file